@@ -0,0 +1,386 @@
+/*
+    Karabo bridge array view.
+
+    Copyright (c) 2018, European X-Ray Free-Electron Laser Facility GmbH
+    All rights reserved.
+
+    You should have received a copy of the 3-Clause BSD License along with this
+    program. If not, see <https://opensource.org/licenses/BSD-3-Clause>
+
+    Author: Jun Zhu, zhujun981661@gmail.com
+*/
+
+#ifndef KARABO_BRIDGE_KB_ARRAY_VIEW_HPP
+#define KARABO_BRIDGE_KB_ARRAY_VIEW_HPP
+
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+
+
+namespace karabo_bridge {
+
+/*
+ * Selection of indices along an axis with the semantics of a Python
+ * slice "start:stop:step", e.g. the pulse slicer "::2" or "0:64" of a
+ * data source. Negative indices count from the end and out-of-range
+ * indices are clipped, except for a single index, which must exist.
+ */
+class Slice {
+
+    std::ptrdiff_t start_;
+    std::ptrdiff_t stop_;
+    std::ptrdiff_t step_;
+    bool has_start_;
+    bool has_stop_;
+    bool is_index_;
+
+    static std::ptrdiff_t parseIndex(const std::string& s, const std::string& slice) {
+        std::size_t pos = 0;
+        long long value = 0;
+        try {
+            value = std::stoll(s, &pos);
+        } catch (const std::logic_error&) {
+            throw std::invalid_argument("Invalid slice: '" + slice + "'");
+        }
+        for (; pos < s.size(); ++pos) {
+            if (!isspace(static_cast<unsigned char>(s[pos])))
+                throw std::invalid_argument("Invalid slice: '" + slice + "'");
+        }
+        return static_cast<std::ptrdiff_t>(value);
+    }
+
+    static bool isBlank(const std::string& s) {
+        for (auto c : s) {
+            if (!isspace(static_cast<unsigned char>(c))) return false;
+        }
+        return true;
+    }
+
+    // clip an index to [lower, upper] after counting a negative one from the end
+    static std::ptrdiff_t clip(std::ptrdiff_t idx, std::ptrdiff_t size,
+                               std::ptrdiff_t lower, std::ptrdiff_t upper) {
+        if (idx < 0) idx += size;
+        if (idx < lower) return lower;
+        return idx > upper ? upper : idx;
+    }
+
+public:
+    // select all the indices, i.e. ":"
+    Slice()
+        : start_(0), stop_(0), step_(1), has_start_(false), has_stop_(false), is_index_(false) {}
+
+    /*
+     * Constructor.
+     *
+     * Exceptions:
+     * std::invalid_argument if step is 0
+     */
+    Slice(std::ptrdiff_t start, std::ptrdiff_t stop, std::ptrdiff_t step=1)
+        : start_(start), stop_(stop), step_(step), has_start_(true), has_stop_(true),
+          is_index_(false) {
+        if (step == 0) throw std::invalid_argument("Slice step cannot be zero!");
+    }
+
+    // select a single index
+    static Slice index(std::ptrdiff_t idx) {
+        Slice s(idx, idx + 1);
+        s.is_index_ = true;
+        return s;
+    }
+
+    /*
+     * Parse a slice "start:stop:step", in which each part can be omitted,
+     * or a single index. An empty string selects all the indices.
+     *
+     * Exceptions:
+     * std::invalid_argument if the string is not a valid slice
+     */
+    static Slice parse(const std::string& slice) {
+        auto first = slice.find(':');
+        if (first == std::string::npos) {
+            if (isBlank(slice)) return Slice();
+            return index(parseIndex(slice, slice));
+        }
+
+        auto second = slice.find(':', first + 1);
+        std::string parts[3] = {slice.substr(0, first),
+                                slice.substr(first + 1, second - first - 1),
+                                second == std::string::npos ? "" : slice.substr(second + 1)};
+        if (parts[2].find(':') != std::string::npos)
+            throw std::invalid_argument("Invalid slice: '" + slice + "'");
+
+        Slice s;
+        if (!isBlank(parts[2])) {
+            s.step_ = parseIndex(parts[2], slice);
+            if (s.step_ == 0) throw std::invalid_argument("Slice step cannot be zero!");
+        }
+        if (!isBlank(parts[0])) {
+            s.start_ = parseIndex(parts[0], slice);
+            s.has_start_ = true;
+        }
+        if (!isBlank(parts[1])) {
+            s.stop_ = parseIndex(parts[1], slice);
+            s.has_stop_ = true;
+        }
+        return s;
+    }
+
+    std::ptrdiff_t step() const { return step_; }
+
+    /*
+     * Resolve the slice along an axis of "size" elements.
+     *
+     * @param first: first selected index.
+     * @param count: number of selected indices.
+     *
+     * Exceptions:
+     * std::out_of_range if a single index is out of range
+     */
+    void resolve(std::size_t size, std::size_t& first, std::size_t& count) const {
+        auto n = static_cast<std::ptrdiff_t>(size);
+        if (is_index_) {
+            auto idx = start_ < 0 ? start_ + n : start_;
+            if (idx < 0 || idx >= n)
+                throw std::out_of_range("Index " + std::to_string(start_) +
+                                        " is out of range for an axis of size " +
+                                        std::to_string(size));
+            first = static_cast<std::size_t>(idx);
+            count = 1;
+            return;
+        }
+
+        std::ptrdiff_t start, stop;
+        if (step_ > 0) {
+            start = has_start_ ? clip(start_, n, 0, n) : 0;
+            stop = has_stop_ ? clip(stop_, n, 0, n) : n;
+            count = stop > start ? static_cast<std::size_t>((stop - start - 1) / step_ + 1) : 0;
+        } else {
+            // -1 stands for before the first element
+            start = has_start_ ? clip(start_, n, -1, n - 1) : n - 1;
+            stop = has_stop_ ? clip(stop_, n, -1, n - 1) : -1;
+            count = start > stop ? static_cast<std::size_t>((start - stop - 1) / -step_ + 1) : 0;
+        }
+        first = count ? static_cast<std::size_t>(start) : 0;
+    }
+};
+
+/*
+ * Non-owning view of a multi-dimensional array with strides, e.g. of the
+ * data of an NDArray (see NDArray::view()).
+ *
+ * Sub-views, slices and transposed views refer to the same data and are
+ * not copied. The strides are in number of elements.
+ */
+template<typename T, std::size_t Rank>
+class NDArrayView {
+
+    static_assert(Rank > 0, "The rank of an array view must be positive!");
+
+    template<typename, std::size_t> friend class NDArrayView;
+
+    T* ptr_;
+    std::array<std::size_t, Rank> shape_;
+    std::array<std::ptrdiff_t, Rank> strides_;
+
+    std::ptrdiff_t offset(std::size_t) const { return 0; }
+
+    template<typename... Indices>
+    std::ptrdiff_t offset(std::size_t dim, std::size_t idx, Indices... indices) const {
+        return static_cast<std::ptrdiff_t>(idx) * strides_[dim] + offset(dim + 1, indices...);
+    }
+
+    // innermost dimension
+    template<typename F>
+    void forEachImp(T* ptr, F& f, std::integral_constant<std::size_t, Rank - 1>) const {
+        auto n = shape_[Rank - 1];
+        auto stride = strides_[Rank - 1];
+        if (stride == 1) {
+            for (std::size_t i = 0; i < n; ++i) f(ptr[i]);
+        } else {
+            for (std::size_t i = 0; i < n; ++i) f(ptr[static_cast<std::ptrdiff_t>(i) * stride]);
+        }
+    }
+
+    template<typename F, std::size_t Dim>
+    void forEachImp(T* ptr, F& f, std::integral_constant<std::size_t, Dim>) const {
+        for (std::size_t i = 0; i < shape_[Dim]; ++i)
+            forEachImp(ptr + static_cast<std::ptrdiff_t>(i) * strides_[Dim], f,
+                       std::integral_constant<std::size_t, Dim + 1>());
+    }
+
+    void checkAxis(std::size_t axis) const {
+        if (axis >= Rank)
+            throw std::out_of_range("Axis " + std::to_string(axis) +
+                                    " is out of range for an array of rank " +
+                                    std::to_string(Rank));
+    }
+
+public:
+    NDArrayView() : ptr_(nullptr), shape_(), strides_() {}
+
+    // view of C-contiguous (row-major) data
+    NDArrayView(T* ptr, const std::array<std::size_t, Rank>& shape)
+        : ptr_(ptr), shape_(shape) {
+        std::ptrdiff_t stride = 1;
+        for (std::size_t i = Rank; i > 0; --i) {
+            strides_[i - 1] = stride;
+            stride *= static_cast<std::ptrdiff_t>(shape[i - 1]);
+        }
+    }
+
+    NDArrayView(T* ptr,
+                const std::array<std::size_t, Rank>& shape,
+                const std::array<std::ptrdiff_t, Rank>& strides)
+        : ptr_(ptr), shape_(shape), strides_(strides) {}
+
+    // pointer to the first element
+    T* data() const { return ptr_; }
+
+    static constexpr std::size_t rank() { return Rank; }
+
+    const std::array<std::size_t, Rank>& shape() const { return shape_; }
+
+    std::size_t shape(std::size_t axis) const { return shape_[axis]; }
+
+    const std::array<std::ptrdiff_t, Rank>& strides() const { return strides_; }
+
+    std::ptrdiff_t stride(std::size_t axis) const { return strides_[axis]; }
+
+    // number of elements
+    std::size_t size() const {
+        std::size_t size = 1;
+        for (auto v : shape_) size *= v;
+        return size;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    // true if the elements are C-contiguous, e.g. the view can be copied at once
+    bool isContiguous() const {
+        std::ptrdiff_t stride = 1;
+        for (std::size_t i = Rank; i > 0; --i) {
+            if (shape_[i - 1] != 1 && strides_[i - 1] != stride) return false;
+            stride *= static_cast<std::ptrdiff_t>(shape_[i - 1]);
+        }
+        return true;
+    }
+
+    // element access without bounds check, e.g. view(module, row, col)
+    template<typename... Indices>
+    T& operator()(Indices... indices) const {
+        static_assert(sizeof...(Indices) == Rank, "The number of indices must equal the rank!");
+        return ptr_[offset(0, static_cast<std::size_t>(indices)...)];
+    }
+
+    /*
+     * Return the sub-view at "index" along "axis", which has one dimension
+     * less, e.g. a module of a detector image.
+     *
+     * Exceptions:
+     * std::out_of_range if the axis or the index is out of range
+     */
+    NDArrayView<T, Rank - 1> select(std::size_t axis, std::size_t index) const {
+        static_assert(Rank > 1, "Use operator() to access an element of a 1D view!");
+        checkAxis(axis);
+        if (index >= shape_[axis])
+            throw std::out_of_range("Index " + std::to_string(index) +
+                                    " is out of range for an axis of size " +
+                                    std::to_string(shape_[axis]));
+
+        NDArrayView<T, Rank - 1> view;
+        view.ptr_ = ptr_ + static_cast<std::ptrdiff_t>(index) * strides_[axis];
+        for (std::size_t i = 0, j = 0; i < Rank; ++i) {
+            if (i == axis) continue;
+            view.shape_[j] = shape_[i];
+            view.strides_[j] = strides_[i];
+            ++j;
+        }
+        return view;
+    }
+
+    // sub-view along the first axis
+    NDArrayView<T, Rank - 1> operator[](std::size_t index) const { return select(0, index); }
+
+    /*
+     * Return the view of the indices selected by "slice" along "axis",
+     * e.g. a pulse selection.
+     *
+     * Exceptions:
+     * std::out_of_range if the axis is out of range
+     */
+    NDArrayView slice(std::size_t axis, const Slice& slice) const {
+        checkAxis(axis);
+        std::size_t first, count;
+        slice.resolve(shape_[axis], first, count);
+
+        NDArrayView view(*this);
+        view.ptr_ = ptr_ + static_cast<std::ptrdiff_t>(first) * strides_[axis];
+        view.shape_[axis] = count;
+        view.strides_[axis] = strides_[axis] * slice.step();
+        return view;
+    }
+
+    // "slice" is parsed by Slice::parse()
+    NDArrayView slice(std::size_t axis, const std::string& slice) const {
+        return this->slice(axis, Slice::parse(slice));
+    }
+
+    /*
+     * Return the view with the axes permuted, i.e. the axis i of the view
+     * is the axis axes[i] of this view.
+     *
+     * Exceptions:
+     * std::invalid_argument if "axes" is not a permutation of the axes
+     */
+    NDArrayView transpose(const std::array<std::size_t, Rank>& axes) const {
+        std::array<bool, Rank> used {};
+        NDArrayView view(*this);
+        for (std::size_t i = 0; i < Rank; ++i) {
+            if (axes[i] >= Rank || used[axes[i]])
+                throw std::invalid_argument("Invalid permutation of the axes!");
+            used[axes[i]] = true;
+            view.shape_[i] = shape_[axes[i]];
+            view.strides_[i] = strides_[axes[i]];
+        }
+        return view;
+    }
+
+    // Return the view with the axes reversed.
+    NDArrayView transpose() const {
+        NDArrayView view(*this);
+        for (std::size_t i = 0; i < Rank; ++i) {
+            view.shape_[i] = shape_[Rank - 1 - i];
+            view.strides_[i] = strides_[Rank - 1 - i];
+        }
+        return view;
+    }
+
+    /*
+     * Call f(element) for all the elements in row-major order of the view.
+     * The innermost loop runs over a raw pointer.
+     */
+    template<typename F>
+    void forEach(F&& f) const {
+        if (empty()) return;
+        if (isContiguous()) {
+            auto n = size();
+            for (std::size_t i = 0; i < n; ++i) f(ptr_[i]);
+            return;
+        }
+        forEachImp(ptr_, f, std::integral_constant<std::size_t, 0>());
+    }
+
+    // Copy the elements in row-major order into "out", which holds size() elements.
+    template<typename U>
+    void copyTo(U* out) const {
+        forEach([&out](const T& v) { *out++ = v; });
+    }
+};
+
+} // karabo_bridge
+
+#endif //KARABO_BRIDGE_KB_ARRAY_VIEW_HPP
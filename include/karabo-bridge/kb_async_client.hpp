@@ -0,0 +1,302 @@
+/*
+    Karabo bridge asynchronous client.
+
+    Copyright (c) 2018, European X-Ray Free-Electron Laser Facility GmbH
+    All rights reserved.
+
+    You should have received a copy of the 3-Clause BSD License along with this
+    program. If not, see <https://opensource.org/licenses/BSD-3-Clause>
+
+    Author: Jun Zhu, zhujun981661@gmail.com
+*/
+
+#ifndef KARABO_BRIDGE_KB_ASYNC_CLIENT_HPP
+#define KARABO_BRIDGE_KB_ASYNC_CLIENT_HPP
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+
+#include "kb_client.hpp"
+
+
+namespace karabo_bridge {
+
+namespace detail {
+
+/*
+ * Bounded lock-free ring buffer for exactly one producer thread and one
+ * consumer thread.
+ */
+template<typename T>
+class SpscRingBuffer {
+
+    // one slot is always left empty to distinguish "full" from "empty"
+    std::vector<T> buffer_;
+
+    // index of the next slot to read, only written by the consumer
+    std::atomic<std::size_t> head_;
+    // avoid false sharing between head_ and tail_
+    char padding_[64];
+    // index of the next slot to write, only written by the producer
+    std::atomic<std::size_t> tail_;
+
+    std::size_t increment(std::size_t idx) const {
+        return ++idx == buffer_.size() ? 0 : idx;
+    }
+
+public:
+    explicit SpscRingBuffer(std::size_t capacity)
+        : buffer_(capacity + 1), head_(0), tail_(0) {}
+
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    /*
+     * Move an item into the buffer. Called by the producer only.
+     *
+     * Return false and leave the item untouched if the buffer is full.
+     */
+    bool tryPush(T&& item) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto next = increment(tail);
+        if (next == head_.load(std::memory_order_acquire)) return false;
+
+        buffer_[tail] = std::move(item);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Move the oldest item out of the buffer. Called by the consumer only.
+     *
+     * Return false if the buffer is empty.
+     */
+    bool tryPop(T& item) {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return false;
+
+        item = std::move(buffer_[head]);
+        buffer_[head] = T(); // release the resource held by the slot
+        head_.store(increment(head), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    // The result is only a snapshot if the buffer is being used.
+    std::size_t size() const {
+        auto head = head_.load(std::memory_order_acquire);
+        auto tail = tail_.load(std::memory_order_acquire);
+        return tail >= head ? tail - head : tail + buffer_.size() - head;
+    }
+
+    std::size_t capacity() const { return buffer_.size() - 1; }
+};
+
+} // detail
+
+/*
+ * Karabo-bridge client which receives and parses data in a background
+ * thread.
+ *
+ * Parsed trains are handed over to the consumer through a bounded lock-free
+ * ring buffer. If the buffer is full, the newly received train is dropped.
+ */
+class AsyncClient {
+
+public:
+    using TrainData = std::map<std::string, kb_data>;
+
+private:
+    Client client_;
+    detail::SpscRingBuffer<TrainData> buffer_;
+
+    std::thread thread_;
+    std::atomic<bool> running_;
+
+    std::atomic<std::size_t> received_;
+    std::atomic<std::size_t> dropped_;
+
+    // exception raised in the receiver thread
+    std::exception_ptr error_;
+
+    // only used to wake up a consumer which is waiting for data
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    // Interval in second for the receiver thread to check whether it should stop.
+    static constexpr double POLL_INTERVAL = 0.1;
+
+    void run() {
+        try {
+            while (running_) {
+                auto data_pkg = client_.next();
+                if (data_pkg.empty()) continue;
+
+                ++received_;
+                if (!buffer_.tryPush(std::move(data_pkg))) {
+                    ++dropped_;
+                    continue;
+                }
+
+                { std::lock_guard<std::mutex> lock(mutex_); }
+                cv_.notify_one();
+            }
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+    }
+
+    static ClientOptions prefetchOptions(std::size_t prefetch) {
+        ClientOptions options;
+        options.prefetch = prefetch;
+        return options;
+    }
+
+    static ClientOptions receiverOptions(ClientOptions options) {
+        options.timeout = POLL_INTERVAL;
+        return options;
+    }
+
+    void checkError() {
+        if (!running_ && error_ && buffer_.empty()) {
+            auto error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+public:
+    /*
+     * Constructor.
+     *
+     * @param capacity: maximum number of parsed trains waiting for the consumer.
+     * @param prefetch: maximum number of "next" requests in flight.
+     */
+    explicit AsyncClient(std::size_t capacity=8, std::size_t prefetch=1)
+        : AsyncClient(prefetchOptions(prefetch), capacity) {}
+
+    /*
+     * Constructor.
+     *
+     * @param options: options of the underlying client. "timeout" is
+     *                 ignored since the receiver thread uses a short
+     *                 timeout to check whether it should stop.
+     * @param capacity: maximum number of parsed trains waiting for the consumer.
+     */
+    explicit AsyncClient(const ClientOptions& options, std::size_t capacity=8)
+        : client_(receiverOptions(options)),
+          buffer_(capacity > 0 ? capacity : 1),
+          running_(false),
+          received_(0),
+          dropped_(0) {}
+
+    ~AsyncClient() { stop(); }
+
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+
+    void connect(const std::string& endpoint) { client_.connect(endpoint); }
+
+    /*
+     * Start the receiver thread.
+     */
+    void start() {
+        if (thread_.joinable()) return;
+        running_ = true;
+        thread_ = std::thread(&AsyncClient::run, this);
+    }
+
+    /*
+     * Stop the receiver thread. Trains already in the buffer can still be
+     * consumed.
+     */
+    void stop() {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+    }
+
+    bool isRunning() const { return running_; }
+
+    /*
+     * Move the oldest train into "data" without waiting.
+     *
+     * Return false if no data is available.
+     *
+     * Exceptions:
+     * std::runtime_error (rethrown) if the receiver thread stopped due to an
+     * error and all the received data have been consumed.
+     */
+    bool tryNext(TrainData& data) {
+        if (buffer_.tryPop(data)) return true;
+        checkError();
+        return false;
+    }
+
+    /*
+     * Move the oldest train into "data" and wait for it if necessary.
+     *
+     * @param timeout: maximum waiting time in second. Negative for infinite.
+     *
+     * Return false if no data is available after timeout.
+     */
+    bool next(TrainData& data, double timeout=-1.) {
+        if (buffer_.tryPop(data)) return true;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto ready = [this]() { return !buffer_.empty() || !running_; };
+            if (timeout < 0) cv_.wait(lock, ready);
+            else
+                cv_.wait_for(lock,
+                             std::chrono::microseconds(static_cast<int64_t>(1e6 * timeout)),
+                             ready);
+        }
+
+        return tryNext(data);
+    }
+
+    /*
+     * Move at most "max_size" available trains into "data" without waiting.
+     *
+     * Return the number of trains appended.
+     */
+    std::size_t drain(std::vector<TrainData>& data,
+                      std::size_t max_size=std::numeric_limits<std::size_t>::max()) {
+        std::size_t n = 0;
+        TrainData train;
+        while (n < max_size && buffer_.tryPop(train)) {
+            data.emplace_back(std::move(train));
+            ++n;
+        }
+        if (n == 0) checkError();
+        return n;
+    }
+
+    // number of trains waiting for the consumer
+    std::size_t size() const { return buffer_.size(); }
+
+    std::size_t capacity() const { return buffer_.capacity(); }
+
+    // number of trains received by the receiver thread
+    std::size_t received() const { return received_; }
+
+    // number of trains dropped because the buffer was full
+    std::size_t dropped() const { return dropped_; }
+};
+
+} // karabo_bridge
+
+#endif //KARABO_BRIDGE_KB_ASYNC_CLIENT_HPP
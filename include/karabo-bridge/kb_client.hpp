@@ -17,6 +17,8 @@
 #include <msgpack.hpp>
 
 #include <string>
+#include <cstring>
+#include <cctype>
 #include <stack>
 #include <array>
 #include <deque>
@@ -24,8 +26,24 @@
 #include <sstream>
 #include <fstream>
 #include <exception>
+#include <stdexcept>
 #include <limits>
 #include <type_traits>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+
+#include "kb_array_view.hpp"
+#include "kb_convert.hpp"
+#include "kb_dtype.hpp"
+#include "kb_filter.hpp"
+#include "kb_thread_pool.hpp"
 
 
 #ifdef __GNUC__
@@ -44,7 +62,7 @@
 
 namespace karabo_bridge {
 
-using MultipartMsg = std::deque<zmq::message_t>;
+using MultipartMsg = std::vector<zmq::message_t>;
 
 // Define exceptions to ease debugging
 
@@ -81,6 +99,131 @@ public:
   ZmqTimeoutError() : std::runtime_error("") {}
 };
 
+/*
+ * Non-owning view of string or binary data, e.g. inside a received frame.
+ */
+class StringView {
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+
+public:
+    StringView() = default;
+    StringView(const char* data, std::size_t size) : data_(data), size_(size) {}
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+    char operator[](std::size_t i) const { return data_[i]; }
+
+    bool operator==(const char* s) const {
+        return size_ == std::strlen(s) && (size_ == 0 || std::memcmp(data_, s, size_) == 0);
+    }
+    bool operator!=(const char* s) const { return !(*this == s); }
+
+    // copy into a string
+    std::string str() const { return std::string(data_, size_); }
+};
+
+namespace detail {
+
+// numeric types which msgpack converts from an array
+template<typename T>
+struct is_bulk_element : std::integral_constant<bool,
+    std::is_arithmetic<T>::value
+    && !std::is_same<T, bool>::value
+    // std::vector<char> and std::vector<unsigned char> are binary data for msgpack
+    && !std::is_same<T, char>::value
+    && !std::is_same<T, unsigned char>::value> {};
+
+// how the elements of a msgpack array of numbers are read
+enum class BulkKind { NONE, FLOAT, SIGNED, UNSIGNED };
+
+template<typename T>
+bool fitsInto(int64_t, uint64_t, std::true_type /* floating point */) { return true; }
+
+template<typename T>
+bool fitsInto(int64_t min, uint64_t max, std::false_type /* integer */) {
+    return min >= static_cast<int64_t>(std::numeric_limits<T>::lowest())
+           && max <= static_cast<uint64_t>(std::numeric_limits<T>::max());
+}
+
+/*
+ * Scan a msgpack array once and return how its elements can be read into
+ * T, or BulkKind::NONE if they are not all floats or all integers which
+ * fit into T. Like the msgpack adaptors, floats are not converted to
+ * integers.
+ */
+template<typename T>
+BulkKind bulkKind(const msgpack::object_array& arr) {
+    bool floats = true;
+    bool integers = true;
+    int64_t min = 0;
+    uint64_t max = 0;
+    for (std::size_t i = 0; i < arr.size; ++i) {
+        auto& obj = arr.ptr[i];
+        floats &= obj.type == msgpack::type::FLOAT32 || obj.type == msgpack::type::FLOAT64;
+        integers &= obj.type == msgpack::type::POSITIVE_INTEGER
+                    || obj.type == msgpack::type::NEGATIVE_INTEGER;
+        if (obj.type == msgpack::type::POSITIVE_INTEGER) max = std::max(max, obj.via.u64);
+        else min = std::min(min, obj.via.i64);
+    }
+
+    if (floats) return std::is_floating_point<T>::value ? BulkKind::FLOAT : BulkKind::NONE;
+    if (!integers || !fitsInto<T>(min, max, std::is_floating_point<T>())) return BulkKind::NONE;
+    // positive integers share the bits of int64_t unless they are larger
+    if (max <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) return BulkKind::SIGNED;
+    return min < 0 ? BulkKind::NONE : BulkKind::UNSIGNED;
+}
+
+/*
+ * Read the elements of a msgpack array into a contiguous buffer. The loops
+ * do not branch on the element type and can be vectorized by the compiler.
+ */
+template<typename T>
+void bulkDecode(const msgpack::object_array& arr, BulkKind kind, T* out) {
+    auto ptr = arr.ptr;
+    auto size = arr.size;
+    if (kind == BulkKind::FLOAT) {
+        // FLOAT32 is also held as double
+        for (std::size_t i = 0; i < size; ++i) out[i] = static_cast<T>(ptr[i].via.f64);
+    } else if (kind == BulkKind::SIGNED) {
+        for (std::size_t i = 0; i < size; ++i) out[i] = static_cast<T>(ptr[i].via.i64);
+    } else {
+        for (std::size_t i = 0; i < size; ++i) out[i] = static_cast<T>(ptr[i].via.u64);
+    }
+}
+
+/*
+ * Convert a msgpack::object to T, with a fast path for an array of numbers
+ * into a std::vector. Other arrays, e.g. of mixed types, are converted
+ * element by element by the msgpack adaptor.
+ */
+template<typename T, typename Enable=void>
+struct object_as_imp {
+    T operator()(const msgpack::object& obj) { return obj.as<T>(); }
+};
+
+template<typename ElementType>
+struct object_as_imp<std::vector<ElementType>,
+                     typename std::enable_if<is_bulk_element<ElementType>::value>::type> {
+    std::vector<ElementType> operator()(const msgpack::object& obj) {
+        if (obj.type == msgpack::type::ARRAY && obj.via.array.size > 0) {
+            auto kind = bulkKind<ElementType>(obj.via.array);
+            if (kind != BulkKind::NONE) {
+                std::vector<ElementType> vec(obj.via.array.size);
+                bulkDecode(obj.via.array, kind, vec.data());
+                return vec;
+            }
+        }
+        return obj.as<std::vector<ElementType>>();
+    }
+};
+
+} // detail
+
 /*
  * Abstract class for MsgpackObject and NDArray.
  */
@@ -90,14 +233,33 @@ protected:
     // size of the flattened array, 0 for scalar data and NIL
     std::size_t size_;
     // data type, if container, it refers to the data type in the container
+    DType dtype_id_;
+    // name of a data type which is not in DType
     std::string dtype_;
+    // keeps the memory of the data alive, e.g. the received frame
+    std::shared_ptr<const void> owner_;
 
 public:
-    Object() : size_(0) {};
+    Object() : size_(0), dtype_id_(DType::UNKNOWN) {};
     virtual ~Object() = default;
 
+    /*
+     * Return the owner of the memory of the data, which is shared by the
+     * copies of the object, or nullptr if the data are not owned.
+     *
+     * A copy of an object received by the client, e.g. an NDArray handed
+     * to a worker thread, keeps its frame alive after the kb_data has been
+     * destroyed or recycled.
+     */
+    const std::shared_ptr<const void>& owner() const { return owner_; }
+
+    // Stop sharing the ownership of the data.
+    void resetOwner() { owner_.reset(); }
+
     virtual std::size_t size() const = 0;
     virtual std::string dtype() const = 0;
+    // same as dtype(), without comparing strings
+    DType dtypeId() const { return dtype_id_; }
     // empty vector for scalar data
     virtual std::vector<std::size_t> shape() const = 0;
     // empty string for scalar data
@@ -114,7 +276,29 @@ class MsgpackObject : public Object {
 public:
     MsgpackObject() = default;  // must be default constructable
 
-    explicit MsgpackObject(const msgpack::object& value): value_(value) {
+    explicit MsgpackObject(const msgpack::object& value,
+                           std::shared_ptr<const void> owner=nullptr) {
+        assign(value, std::move(owner));
+    }
+
+    ~MsgpackObject() override = default;
+
+    MsgpackObject(const MsgpackObject&) = default;
+    MsgpackObject& operator=(const MsgpackObject&) = default;
+
+    MsgpackObject(MsgpackObject&&) = default;
+    MsgpackObject& operator=(MsgpackObject&&) = default;
+
+    /*
+     * Hold another msgpack::object.
+     *
+     * @param owner: owner of the memory "value" refers to, nullptr
+     *               (default) for none.
+     */
+    void assign(const msgpack::object& value, std::shared_ptr<const void> owner=nullptr) {
+        value_ = value;
+        owner_ = std::move(owner);
+        size_ = 0;
         if (value.type == msgpack::type::object_type::ARRAY
                 || value.type == msgpack::type::object_type::MAP
                 || value.type == msgpack::type::object_type::BIN)
@@ -122,25 +306,17 @@ public:
 
         if (value.type == msgpack::type::object_type::ARRAY)
             if (value.via.array.ptr)
-                dtype_ = getTypeString(value.via.array.ptr[0].type);
+                dtype_id_ = toDType(value.via.array.ptr[0].type);
             else
-                dtype_ = "unknown";
+                dtype_id_ = DType::UNKNOWN;
         else if (value.type == msgpack::type::object_type::BIN)
-            dtype_ = "char";
+            dtype_id_ = DType::CHAR;
         else if (value.type == msgpack::type::object_type::MAP
                 || value.type == msgpack::type::object_type::EXT)
-            dtype_ = "undefined";
-        else dtype_ = getTypeString(value.type);
+            dtype_id_ = DType::UNDEFINED;
+        else dtype_id_ = toDType(value.type);
     }
 
-    ~MsgpackObject() override = default;
-
-    MsgpackObject(const MsgpackObject&) = default;
-    MsgpackObject& operator=(const MsgpackObject&) = default;
-
-    MsgpackObject(MsgpackObject&&) = default;
-    MsgpackObject& operator=(MsgpackObject&&) = default;
-
     /*
      * Cast the held msgpack::object to a given type.
      *
@@ -150,7 +326,7 @@ public:
     template<typename T>
     T as() const {
         try {
-            return value_.as<T>();
+            return detail::object_as_imp<T>()(value_);
         } catch(std::bad_cast& e) {
             std::string error_msg;
             if (size_)
@@ -162,7 +338,67 @@ public:
         }
     }
 
-    std::string dtype() const override { return dtype_; }
+    /*
+     * Return a view of string or binary data without copy. The view refers
+     * to the received frame and is only valid during the lifetime of the
+     * kb_data which holds the object.
+     *
+     * Exceptions:
+     * CastErrorMsgpackObject: if the object is neither a string nor binary data
+     */
+    StringView view() const {
+        if (value_.type == msgpack::type::object_type::STR)
+            return StringView(value_.via.str.ptr, value_.via.str.size);
+        if (value_.type == msgpack::type::object_type::BIN)
+            return StringView(value_.via.bin.ptr, value_.via.bin.size);
+        throw CastErrorMsgpackObject("The expected type is string or bin");
+    }
+
+    /*
+     * Call "f" with the held data as their own type: bool, uint64_t,
+     * int64_t, float, double or StringView (string and binary data) for
+     * scalar data, and a std::vector of it for an array, e.g. with
+     *
+     *     struct Count {
+     *         template<typename T>
+     *         std::size_t operator()(const std::vector<T>& values) const { return values.size(); }
+     *         template<typename T>
+     *         std::size_t operator()(const T&) const { return 1; }
+     *     };
+     *
+     *     std::size_t n = obj.visit(Count());
+     *
+     * The return type is deduced from f(double()), so "f" must accept a
+     * double and return the same type for all the data types.
+     *
+     * Exceptions:
+     * CastErrorMsgpackObject: if the data is NIL, a map, an array of
+     *                         arrays or maps, or an array of mixed types
+     */
+    template<typename F>
+    auto visit(F&& f) const -> decltype(f(double())) {
+        bool is_array = value_.type == msgpack::type::object_type::ARRAY;
+        switch (dtype_id_) {
+            case DType::BOOL:
+                return is_array ? f(as<std::vector<bool>>()) : f(as<bool>());
+            case DType::UINT64:
+                return is_array ? f(as<std::vector<uint64_t>>()) : f(as<uint64_t>());
+            case DType::INT64:
+                return is_array ? f(as<std::vector<int64_t>>()) : f(as<int64_t>());
+            case DType::FLOAT:
+                return is_array ? f(as<std::vector<float>>()) : f(as<float>());
+            case DType::DOUBLE:
+                return is_array ? f(as<std::vector<double>>()) : f(as<double>());
+            case DType::STRING:
+                return is_array ? f(as<std::vector<StringView>>()) : f(view());
+            case DType::CHAR:
+                return f(view());
+            default:
+                throw CastErrorMsgpackObject("Data of type " + dtype() + " cannot be visited");
+        }
+    }
+
+    std::string dtype() const override { return dtypeName(dtype_id_); }
 
     std::size_t size() const override { return size_; }
 
@@ -177,27 +413,26 @@ public:
                 || value_.type == msgpack::type::object_type::BIN)
             return "array-like";
         if (value_.type == msgpack::type::object_type::MAP) return "map";
-        return getTypeString(value_.type);
+        return dtypeName(toDType(value_.type));
     }
 
 private:
-    // map msgpack object types to strings
-    static std::string getTypeString(msgpack::type::object_type type) {
-        const std::map<msgpack::type::object_type, std::string> map {
-            {msgpack::type::object_type::NIL, "MSGPACK_OBJECT_NIL"},
-            {msgpack::type::object_type::BOOLEAN, "bool"},
-            {msgpack::type::object_type::POSITIVE_INTEGER, "uint64_t"},
-            {msgpack::type::object_type::NEGATIVE_INTEGER, "int64_t"},
-            {msgpack::type::object_type::FLOAT32, "float"},
-            {msgpack::type::object_type::FLOAT64, "double"},
-            {msgpack::type::object_type::STR, "string"},
-            {msgpack::type::object_type::ARRAY, "MSGPACK_OBJECT_ARRAY"},
-            {msgpack::type::object_type::MAP, "MSGPACK_OBJECT_MAP"},
-            {msgpack::type::object_type::BIN, "MSGPACK_OBJECT_BIN"},
-            {msgpack::type::object_type::EXT, "MSGPACK_OBJECT_EXT"}
-        };
-
-        return map.at(type);
+    // map msgpack object types to data types
+    static DType toDType(msgpack::type::object_type type) {
+        switch (type) {
+            case msgpack::type::object_type::NIL: return DType::NIL;
+            case msgpack::type::object_type::BOOLEAN: return DType::BOOL;
+            case msgpack::type::object_type::POSITIVE_INTEGER: return DType::UINT64;
+            case msgpack::type::object_type::NEGATIVE_INTEGER: return DType::INT64;
+            case msgpack::type::object_type::FLOAT32: return DType::FLOAT;
+            case msgpack::type::object_type::FLOAT64: return DType::DOUBLE;
+            case msgpack::type::object_type::STR: return DType::STRING;
+            case msgpack::type::object_type::ARRAY: return DType::ARRAY;
+            case msgpack::type::object_type::MAP: return DType::MAP;
+            case msgpack::type::object_type::BIN: return DType::BIN;
+            case msgpack::type::object_type::EXT: return DType::EXT;
+            default: return DType::UNKNOWN;
+        }
     }
 };
 
@@ -206,7 +441,7 @@ using ObjectPair = std::pair<std::string, MsgpackObject>;
 
 namespace detail {
 
-template<typename Container, typename ElementType>
+template<typename Container, typename ElementType, typename Enable=void>
 struct as_imp {
     Container operator()(void* ptr_, std::size_t size) {
         auto ptr = reinterpret_cast<const ElementType*>(ptr_);
@@ -214,6 +449,37 @@ struct as_imp {
     }
 };
 
+/*
+ * Resize "vec" before a large array is converted into it. The new pages are
+ * first touched by the threads of the conversion, so that the zero-filling
+ * on the calling thread does not take all the page faults.
+ */
+template<typename T>
+void resizeForConvert(std::vector<T>& vec, std::size_t size) {
+    if (size > vec.capacity() && size * sizeof(T) >= PARALLEL_CONVERT_THRESHOLD) {
+        std::size_t old_size = vec.size();
+        vec.reserve(size);
+        touchPages(reinterpret_cast<char*>(vec.data() + old_size), (size - old_size) * sizeof(T));
+    }
+    vec.resize(size);
+}
+
+// partial specialization for std::vector, which copies large arrays in
+// parallel, see convertArray and resizeForConvert
+template<typename ElementType>
+struct as_imp<std::vector<ElementType>, ElementType,
+              typename std::enable_if<!std::is_same<ElementType, bool>::value>::type> {
+    std::vector<ElementType> operator()(void* ptr_, std::size_t size) {
+        auto ptr = reinterpret_cast<const ElementType*>(ptr_);
+        if (size * sizeof(ElementType) < PARALLEL_CONVERT_THRESHOLD)
+            return std::vector<ElementType>(ptr, ptr + size);
+        std::vector<ElementType> vec;
+        resizeForConvert(vec, size);
+        convertArray(ptr, vec.data(), size);
+        return vec;
+    }
+};
+
 // partial specialization for std::array
 template<typename ElementType, std::size_t N>
 struct as_imp<std::array<ElementType, N>, ElementType> {
@@ -223,11 +489,22 @@ struct as_imp<std::array<ElementType, N>, ElementType> {
                 " is different from the expected size " + std::to_string(size));
         auto ptr = reinterpret_cast<const ElementType*>(ptr_);
         std::array<ElementType, N> arr;
-        memcpy(arr.data(), ptr, size * sizeof(ElementType));
+        convertArray(ptr, arr.data(), size);
         return arr;
     }
 };
 
+/*
+ * Convert the visited array data into "out".
+ */
+template<typename T>
+struct ConvertVisitor {
+    T* out;
+
+    template<typename Src>
+    void operator()(const Src* src, std::size_t size) const { convertArray(src, out, size); }
+};
+
 }  // detail
 
 /*
@@ -242,14 +519,11 @@ public:
     NDArray() = default;
 
     // shape and dtype should be moved into the constructor
-    NDArray(void* ptr, const std::vector<std::size_t>& shape, const std::string& dtype):
-            ptr_(ptr), shape_(shape) {
-        std::size_t size = 1;
-        // Overflow is not expected since otherwise zmq::message_t
-        // cannot hold the data.
-        for (auto& v : shape) size *= v;
-        size_ = size;
-        dtype_ = dtype;
+    NDArray(void* ptr,
+            const std::vector<std::size_t>& shape,
+            const std::string& dtype,
+            std::shared_ptr<const void> owner=nullptr) {
+        assign(ptr, shape, dtype, std::move(owner));
     }
 
     ~NDArray() override = default;
@@ -260,6 +534,46 @@ public:
     NDArray(NDArray&&) = default;
     NDArray& operator=(NDArray&&) = default;
 
+    NDArray(void* ptr,
+            const std::vector<std::size_t>& shape,
+            DType dtype,
+            std::shared_ptr<const void> owner=nullptr) {
+        assign(ptr, shape, dtype, std::move(owner));
+    }
+
+    /*
+     * Hold another data chunk. The memory of the shape is reused, unlike
+     * when assigning a new NDArray.
+     *
+     * @param owner: owner of the memory of the data, nullptr (default)
+     *               for none.
+     */
+    void assign(void* ptr,
+                const std::vector<std::size_t>& shape,
+                DType dtype,
+                std::shared_ptr<const void> owner=nullptr) {
+        ptr_ = ptr;
+        owner_ = std::move(owner);
+        shape_ = shape;
+        std::size_t size = 1;
+        // Overflow is not expected since otherwise zmq::message_t
+        // cannot hold the data.
+        for (auto& v : shape) size *= v;
+        size_ = size;
+        dtype_id_ = dtype;
+        dtype_.clear();
+    }
+
+    // dtype is the name of a C++ type, e.g. "uint16_t"
+    void assign(void* ptr,
+                const std::vector<std::size_t>& shape,
+                const std::string& dtype,
+                std::shared_ptr<const void> owner=nullptr) {
+        assign(ptr, shape, toDType(dtype), std::move(owner));
+        // keep the name of a type which is not supported
+        if (dtype_id_ == DType::UNKNOWN) dtype_ = dtype;
+    }
+
     std::size_t size() const override { return size_; }
 
     /*
@@ -273,16 +587,55 @@ public:
              typename = typename std::enable_if<!std::is_integral<Container>::value>::type>
     Container as() const {
         typedef typename Container::value_type ElementType;
-        if (!validateType<ElementType>(dtype_))
+        if (!validateType<ElementType>())
             throw TypeMismatchErrorNDArray(
                 "The expected type is a(n) " + containerType() + " of " + dtype());
         detail::as_imp<Container, ElementType> as_imp_instance;
         return as_imp_instance(ptr_, size());
     }
 
+    /*
+     * Copy the data into a vector (or a std::array) after converting them
+     * to its element type, e.g.
+     *
+     *     auto vec = array.as<std::vector<float>>(karabo_bridge::convert);
+     *
+     * See convertArray for the conversion.
+     *
+     * Exceptions:
+     * TypeMismatchErrorNDArray: if the type of the data is not numeric
+     * CastErrorNDArray: if cast fails
+     */
+    template<typename Container>
+    Container as(convert_t) const {
+        Container out;
+        resize(out, size_);
+        convertTo(out.data(), out.size());
+        return out;
+    }
+
+    /*
+     * Convert the data to the type of "out", which holds "size" elements.
+     * Large arrays are converted in parallel. See convertArray.
+     *
+     * Exceptions:
+     * TypeMismatchErrorNDArray: if the type of the data is not numeric
+     * CastErrorNDArray: if "size" is different from the size of the array
+     */
+    template<typename T>
+    void convertTo(T* out, std::size_t size) const {
+        if (size != size_)
+            throw CastErrorNDArray("The output size " + std::to_string(size) +
+                " is different from the expected size " + std::to_string(size_));
+        visit(detail::ConvertVisitor<T>{out});
+    }
+
     std::vector<std::size_t> shape() const override { return shape_; }
 
-    std::string dtype() const override { return dtype_; }
+    std::string dtype() const override {
+        // "unknown", as for a MsgpackObject, unless the name of an unsupported type is known
+        return dtype_.empty() ? dtypeName(dtype_id_) : dtype_;
+    }
 
     std::string containerType() const override { return "array-like"; }
 
@@ -294,7 +647,7 @@ public:
      */
     template<typename T>
     T* data() const {
-        if (!validateType<T>(dtype_))
+        if (!validateType<T>())
             throw TypeMismatchErrorNDArray("The expected pointer type is " + dtype());
         return reinterpret_cast<T*>(ptr_);
     }
@@ -302,25 +655,80 @@ public:
     // Return a void pointer to the held array data.
     void* data() const { return ptr_; }
 
+    /*
+     * Return a strided view of the held array data, e.g.
+     *
+     *     auto view = array.view<float, 4>();  // [pulse, module, row, col]
+     *     auto even_pulses = view.slice(0, "::2");
+     *
+     * Exceptions:
+     * TypeMismatchErrorNDArray: if type mismatches
+     * CastErrorNDArray: if the number of dimensions is not Rank
+     */
+    template<typename T, std::size_t Rank>
+    NDArrayView<T, Rank> view() const {
+        if (shape_.size() != Rank)
+            throw CastErrorNDArray("The view rank " + std::to_string(Rank) +
+                " is different from the array rank " + std::to_string(shape_.size()));
+        std::array<std::size_t, Rank> shape;
+        std::copy(shape_.begin(), shape_.end(), shape.begin());
+        return NDArrayView<T, Rank>(data<T>(), shape);
+    }
+
+    /*
+     * Call "f" with the pointer of the held array data casted to its type
+     * and the number of elements, e.g. with
+     *
+     *     struct Sum {
+     *         template<typename T>
+     *         double operator()(const T* ptr, std::size_t size) const {
+     *             return std::accumulate(ptr, ptr + size, 0.);
+     *         }
+     *     };
+     *
+     *     double sum = array.visit(Sum());
+     *
+     * The return type is deduced from f(float*, std::size_t), so "f" must
+     * return the same type for all the data types.
+     *
+     * Exceptions:
+     * TypeMismatchErrorNDArray: if the type is not supported
+     */
+    template<typename F>
+    auto visit(F&& f) const -> decltype(f(static_cast<float*>(nullptr), std::size_t())) {
+        switch (dtype_id_) {
+            case DType::BOOL: return f(static_cast<bool*>(ptr_), size_);
+            case DType::INT8: return f(static_cast<int8_t*>(ptr_), size_);
+            case DType::INT16: return f(static_cast<int16_t*>(ptr_), size_);
+            case DType::INT32: return f(static_cast<int32_t*>(ptr_), size_);
+            case DType::INT64: return f(static_cast<int64_t*>(ptr_), size_);
+            case DType::UINT8: return f(static_cast<uint8_t*>(ptr_), size_);
+            case DType::UINT16: return f(static_cast<uint16_t*>(ptr_), size_);
+            case DType::UINT32: return f(static_cast<uint32_t*>(ptr_), size_);
+            case DType::UINT64: return f(static_cast<uint64_t*>(ptr_), size_);
+            case DType::FLOAT: return f(static_cast<float*>(ptr_), size_);
+            case DType::DOUBLE: return f(static_cast<double*>(ptr_), size_);
+            default:
+                throw TypeMismatchErrorNDArray("Arrays of type " + dtype() + " cannot be visited");
+        }
+    }
+
 private:
+    template<typename T>
+    static void resize(std::vector<T>& vec, std::size_t size) { detail::resizeForConvert(vec, size); }
+
+    // a std::array cannot be resized, convertTo checks its size
+    template<typename T, std::size_t N>
+    static void resize(std::array<T, N>&, std::size_t) {}
+
     /*
      * Use to check data type before casting an NDArray object.
      *
      * Implicit type conversion is not allowed.
      */
     template <typename T>
-    static bool validateType(const std::string& type_string) {
-        if (type_string == "uint64_t" && std::is_same<T, uint64_t>::value) return true;
-        if (type_string == "uint32_t" && std::is_same<T, uint32_t>::value) return true;
-        if (type_string == "uint16_t" && std::is_same<T, uint16_t>::value) return true;
-        if (type_string == "uint8_t" && std::is_same<T, uint8_t>::value) return true;
-        if (type_string == "int64_t" && std::is_same<T, int64_t>::value) return true;
-        if (type_string == "int32_t" && std::is_same<T, int32_t>::value) return true;
-        if (type_string == "int16_t" && std::is_same<T, int16_t>::value) return true;
-        if (type_string == "int8_t" && std::is_same<T, int8_t>::value) return true;
-        if (type_string == "float" && std::is_same<T, float>::value) return true;
-        if (type_string == "double" && std::is_same<T, double>::value) return true;
-        return (type_string == "bool" && std::is_same<T, bool>::value);
+    bool validateType() const {
+        return dtype_id_ != DType::UNKNOWN && dtype_id_ == dtype_of<T>::value;
     }
 };
 
@@ -341,6 +749,20 @@ struct as<karabo_bridge::MsgpackObject> {
     }
 };
 
+/*
+ * template specialization for karabo_bridge::StringView, which refers to
+ * the string or binary data without copy
+ */
+template<>
+struct convert<karabo_bridge::StringView> {
+    msgpack::object const& operator()(msgpack::object const& o, karabo_bridge::StringView& v) const {
+        if (o.type == msgpack::type::STR) v = karabo_bridge::StringView(o.via.str.ptr, o.via.str.size);
+        else if (o.type == msgpack::type::BIN) v = karabo_bridge::StringView(o.via.bin.ptr, o.via.bin.size);
+        else throw msgpack::type_error();
+        return o;
+    }
+};
+
 } // adaptor
 } // MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
 } // msgpack
@@ -349,140 +771,1693 @@ struct as<karabo_bridge::MsgpackObject> {
 namespace karabo_bridge {
 
 /*
- * Data structure presented to the user.
+ * Handle of an interned key, see KeyTable.
+ */
+class Key {
+    std::size_t id_;
+
+public:
+    explicit Key(std::size_t id) : id_(id) {}
+
+    std::size_t id() const { return id_; }
+
+    bool operator==(const Key& other) const { return id_ == other.id_; }
+    bool operator!=(const Key& other) const { return id_ != other.id_; }
+};
+
+/*
+ * Dictionary of the keys (the paths of the array data and the keys of the
+ * other data) which persists across trains.
  *
- * - The data member "metadata" holds a map of meta data;
- * - The data member "array" holds a map of array data, which is usually a
- *   big chunk of data;
- * - The data member "data_" holds a map of normal data, which can be either
- *   scalar data or small arrays.
+ * Each key is given a small integer id, by which the data of a kb_data
+ * are indexed. A key can thus be resolved to a Key once and then be
+ * looked up in every train without string comparison. The table can be
+ * shared by several clients and is thread-safe.
  */
-struct kb_data {
-    kb_data() = default;
+class KeyTable {
+    std::unordered_map<std::string, std::size_t> ids_;
+    std::vector<std::string> names_;
+    mutable std::mutex mutex_;
 
-    ~kb_data() = default;
+public:
+    KeyTable() = default;
+
+    KeyTable(const KeyTable&) = delete;
+    KeyTable& operator=(const KeyTable&) = delete;
+
+    // Return the handle of a key, which is added if necessary.
+    Key intern(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) return Key(it->second);
+        ids_.emplace(name, names_.size());
+        names_.push_back(name);
+        return Key(names_.size() - 1);
+    }
 
-    kb_data(const kb_data&) = delete;
-    kb_data& operator=(const kb_data&) = delete;
+    /*
+     * Return the name of a key.
+     *
+     * Exceptions:
+     * std::out_of_range if the key does not belong to the table
+     */
+    std::string name(Key key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return names_.at(key.id());
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return names_.size();
+    }
+};
 
-    kb_data(kb_data&&) = default;
-    kb_data& operator=(kb_data&&) = default;
+namespace detail {
 
-    using iterator = ObjectMap::iterator;
-    using const_iterator = ObjectMap::const_iterator;
+// Frames up to this size may hold their data inside zmq::message_t, which
+// is moved together with the message, so they are never referenced.
+constexpr std::size_t MIN_REFERENCED_FRAME_SIZE = 64;
 
-    ObjectMap metadata;
-    std::map<std::string, NDArray> array;
+inline bool referenceFrame(msgpack::type::object_type /*type*/,
+                           std::size_t /*length*/,
+                           void* /*user_data*/) {
+    return true;
+}
+
+/*
+ * Unpack a frame into "zone". The string, binary and ext data refer to the
+ * frame instead of being copied, so the frame must outlive the result.
+ *
+ * The v1 unpacker is used since it parses with a fixed-size stack, while
+ * the newer ones allocate their stacks for every frame.
+ *
+ * Exceptions:
+ * msgpack::unpack_error if the frame is not valid msgpack
+ */
+inline msgpack::object unpackFrame(msgpack::zone& zone, const zmq::message_t& msg) {
+    auto data = static_cast<const char*>(msg.data());
+    if (msg.size() > MIN_REFERENCED_FRAME_SIZE)
+        return msgpack::v1::unpack(zone, data, msg.size(), referenceFrame);
+    return msgpack::v1::unpack(zone, data, msg.size());
+}
+
+/*
+ * msgpack zone which is cleared and reused for the frames of the following
+ * trains.
+ *
+ * A zone only keeps its first chunk when it is cleared. It is therefore
+ * replaced by one with a larger chunk whenever the frames unpacked since
+ * the last clear() did not fit into the first chunk, so that unpacking the
+ * frames of a stable schema stops allocating after a few trains.
+ */
+class ReusableZone {
 
-    MsgpackObject& operator[](const std::string& key) { return data_.at(key); }
+    std::unique_ptr<msgpack::zone> zone_; // created on the first use
+    std::size_t chunk_size_ = MSGPACK_ZONE_CHUNK_SIZE;
+    std::uintptr_t begin_ = 0; // start of the first chunk
 
-    iterator begin() noexcept { return data_.begin(); }
-    iterator end() noexcept { return data_.end(); }
-    const_iterator begin() const noexcept { return data_.begin(); }
-    const_iterator end() const noexcept { return data_.end(); }
-    const_iterator cbegin() const noexcept { return data_.cbegin(); }
-    const_iterator cend() const noexcept { return data_.cend(); }
+    // address of the next allocation
+    std::uintptr_t top() const {
+        return reinterpret_cast<std::uintptr_t>(zone_->allocate_no_align(0));
+    }
 
-    template<typename T>
-    std::pair<iterator, bool> insert(T&& value) {
-        return data_.insert(std::forward<T>(value));
+    void create() {
+        zone_.reset(new msgpack::zone(chunk_size_));
+        begin_ = top();
+    }
+
+public:
+    // Unpack a frame, see unpackFrame().
+    msgpack::object unpack(const zmq::message_t& msg) {
+        if (!zone_) create();
+        return unpackFrame(*zone_, msg);
+    }
+
+    // Release the unpacked data, which must not be used any more.
+    void clear() {
+        if (!zone_) return;
+        // The top is outside of the first chunk if another one has been
+        // allocated (the subtraction wraps around below the first chunk).
+        if (top() - begin_ > chunk_size_) {
+            chunk_size_ *= 2;
+            create();
+        } else {
+            zone_->clear();
+        }
+    }
+};
+
+/*
+ * A received frame, which is shared by the kb_data that received it and
+ * by the objects referring to its bytes, see Object::owner().
+ */
+struct Frame {
+    zmq::message_t msg;
+    ReusableZone zone; // the frame is unpacked into, if it is msgpack
+};
+
+/*
+ * Refill of a map with the data of the next train, which reuses the nodes
+ * of the keys already in the map. The entries which have not been set
+ * since start() are erased by finish().
+ */
+class MapRefill {
+
+    std::vector<const void*> set_; // values set since start()
+    std::size_t inserted_ = 0; // number of keys inserted since start()
+
+public:
+    void start() {
+        set_.clear();
+        inserted_ = 0;
+    }
+
+    // Return the value of a key, which is inserted if necessary.
+    template<typename Map>
+    typename Map::mapped_type& operator()(Map& map, const std::string& key) {
+        auto it = map.lower_bound(key);
+        if (it == map.end() || it->first != key) {
+            it = map.emplace_hint(it, key, typename Map::mapped_type());
+            ++inserted_;
+        }
+        set_.push_back(&it->second);
+        return it->second;
+    }
+
+    template<typename Map>
+    void finish(Map& map) {
+        if (inserted_ == map.size()) return; // nothing was there before
+
+        std::less<const void*> less;
+        std::sort(set_.begin(), set_.end(), less);
+        // a duplicated key is set twice
+        set_.erase(std::unique(set_.begin(), set_.end()), set_.end());
+        if (set_.size() == map.size()) return;
+
+        for (auto it = map.begin(); it != map.end();) {
+            const void* value = &it->second;
+            if (std::binary_search(set_.begin(), set_.end(), value, less)) ++it;
+            else it = map.erase(it);
+        }
+    }
+};
+
+/*
+ * Flat index of the data of a source by interned key.
+ *
+ * The entries are sorted by key id, so that the index only grows with the
+ * number of keys of the source. The keys of a cached layout are set in
+ * this order (see DataLayout), i.e. they are simply appended.
+ */
+template<typename T>
+class KeyIndex {
+    using Entry = std::pair<std::size_t, T*>;
+    std::vector<Entry> entries_;
+
+    static bool before(const Entry& entry, std::size_t id) { return entry.first < id; }
+
+public:
+    void set(Key key, T* value) {
+        auto id = key.id();
+        if (entries_.empty() || entries_.back().first < id) {
+            entries_.emplace_back(id, value);
+            return;
+        }
+        auto it = std::lower_bound(entries_.begin(), entries_.end(), id, before);
+        if (it != entries_.end() && it->first == id) it->second = value;
+        else entries_.emplace(it, id, value);
     }
 
-    std::size_t bytesReceived() const {
-        std::size_t size_ = 0;
-        for (auto& m : mpmsg_) size_ += m.size();
-        return size_;
+    // Return the entry of a key, or nullptr.
+    T* find(Key key) const {
+        auto it = std::lower_bound(entries_.begin(), entries_.end(), key.id(), before);
+        return it != entries_.end() && it->first == key.id() ? it->second : nullptr;
+    }
+
+    // The memory is kept for the next train.
+    void clear() { entries_.clear(); }
+
+    std::size_t size() const { return entries_.size(); }
+
+    void swap(KeyIndex& other) { entries_.swap(other.entries_); }
+};
+
+/*
+ * A numpy data type supported by msgpack-numpy arrays.
+ */
+struct NumpyType {
+    const char* code; // kind and item size, e.g. "f4"
+    DType dtype;
+};
+
+/*
+ * Return the numpy data type of a type string, e.g. "<f4", or nullptr if it
+ * is not supported. Only the byte order of the host is supported.
+ */
+inline const NumpyType* numpyType(const StringView& type) {
+    static const NumpyType types[] {
+        {"b1", DType::BOOL},
+        {"i1", DType::INT8}, {"i2", DType::INT16}, {"i4", DType::INT32}, {"i8", DType::INT64},
+        {"u1", DType::UINT8}, {"u2", DType::UINT16}, {"u4", DType::UINT32}, {"u8", DType::UINT64},
+        {"f4", DType::FLOAT}, {"f8", DType::DOUBLE}
+    };
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    constexpr char host_order = '>';
+#else
+    constexpr char host_order = '<';
+#endif
+
+    if (type.size() != 3) return nullptr;
+    for (auto& t : types) {
+        if (t.code[0] != type[1] || t.code[1] != type[2]) continue;
+        // single-byte types have no byte order
+        if (type[0] == '|' || type[0] == '=' || type[0] == host_order
+                || t.code[1] == '1') return &t;
+        return nullptr;
+    }
+    return nullptr;
+}
+
+/*
+ * Extract an array encoded by msgpack-numpy, i.e. a map with the keys
+ * "nd" (true), "type" (e.g. "<f4"), "shape", "data" (the bytes) and
+ * optionally "kind" (empty). The data are not copied.
+ *
+ * Return the data type of the array, or nullptr if "obj" is not such an
+ * array or its type is not supported.
+ */
+inline const NumpyType* numpyArray(const msgpack::object& obj,
+                                   void*& ptr,
+                                   std::vector<std::size_t>& shape) {
+    if (obj.type != msgpack::type::MAP || obj.via.map.size < 4 || obj.via.map.size > 5)
+        return nullptr;
+
+    bool nd = false;
+    const NumpyType* dtype = nullptr;
+    const msgpack::object* shape_obj = nullptr;
+    const msgpack::object* data = nullptr;
+    for (std::size_t i = 0; i < obj.via.map.size; ++i) {
+        auto& kv = obj.via.map.ptr[i];
+        if (kv.key.type != msgpack::type::STR && kv.key.type != msgpack::type::BIN) return nullptr;
+        auto key = kv.key.as<StringView>();
+        auto& val = kv.val;
+        bool is_bytes = val.type == msgpack::type::STR || val.type == msgpack::type::BIN;
+
+        if (key == "nd") nd = val.type == msgpack::type::BOOLEAN && val.via.boolean;
+        else if (key == "type") dtype = is_bytes ? numpyType(val.as<StringView>()) : nullptr;
+        else if (key == "shape") shape_obj = &val;
+        else if (key == "data") data = is_bytes ? &val : nullptr;
+        else if (key == "kind") { if (!is_bytes || !val.as<StringView>().empty()) return nullptr; }
+        else return nullptr;
+    }
+    if (!nd || !dtype || !shape_obj || !data || shape_obj->type != msgpack::type::ARRAY)
+        return nullptr;
+
+    // the size in bytes must not overflow, otherwise a huge shape could
+    // match the size of the data
+    const std::size_t max_size = std::numeric_limits<std::size_t>::max();
+    shape.clear();
+    std::size_t size = 1;
+    for (std::size_t i = 0; i < shape_obj->via.array.size; ++i) {
+        auto& dim = shape_obj->via.array.ptr[i];
+        if (dim.type != msgpack::type::POSITIVE_INTEGER || dim.via.u64 > max_size) return nullptr;
+        auto n = static_cast<std::size_t>(dim.via.u64);
+        if (n != 0 && size > max_size / n) return nullptr;
+        shape.push_back(n);
+        size *= n;
+    }
+
+    auto bytes = data->as<StringView>();
+    auto item_size = karabo_bridge::itemSize(dtype->dtype);
+    if (item_size != 0 && size > max_size / item_size) return nullptr;
+    if (size * item_size != bytes.size()) return nullptr;
+    ptr = const_cast<char*>(bytes.data());
+    return dtype;
+}
+
+/*
+ * Keys of the "msgpack" data of a source in the order in which they are
+ * received, together with the order in which they are inserted.
+ */
+struct DataLayout {
+    std::vector<std::string> keys;
+    std::vector<Key> ids; // interned keys, empty without a key table
+    // indices of the keys sorted by id if they are interned, otherwise by name
+    std::vector<std::size_t> order;
+};
+
+/*
+ * Aligned copies of the data of the arrays encoded by msgpack-numpy whose
+ * bytes are not aligned for their type in the frame, e.g. a float array
+ * starting at an odd offset.
+ *
+ * The buffers are reused once they are not shared by any NDArray.
+ */
+class AlignedBuffers {
+    std::vector<std::shared_ptr<std::vector<uint64_t>>> buffers_;
+    std::size_t n_used_ = 0;
+
+public:
+    // Return an aligned copy of "size" bytes at "data".
+    std::shared_ptr<std::vector<uint64_t>> copy(const void* data, std::size_t size) {
+        if (n_used_ == buffers_.size()) buffers_.emplace_back();
+        auto& buffer = buffers_[n_used_++];
+        if (!buffer || buffer.use_count() > 1) buffer = std::make_shared<std::vector<uint64_t>>();
+        buffer->resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        if (size > 0) std::memcpy(buffer->data(), data, size);
+        return buffer;
+    }
+
+    // Release the buffers for reuse. The buffers still shared are replaced.
+    void recycle() { n_used_ = 0; }
+
+    void swap(AlignedBuffers& other) {
+        buffers_.swap(other.buffers_);
+        std::swap(n_used_, other.n_used_);
+    }
+};
+
+/*
+ * Maps which the "msgpack" data of a source are filled into, see
+ * LayoutSlot::fill().
+ */
+struct FillTarget {
+    ObjectMap* data;
+    // flat index of the data by interned key, nullptr for none
+    KeyIndex<MsgpackObject>* data_index = nullptr;
+    // state of the refill of "data", nullptr for a temporary one
+    MapRefill* data_refill = nullptr;
+
+    // Arrays encoded by msgpack-numpy are set in "arrays" instead of "data"
+    // through "array_refill", which the caller finishes. nullptr (default)
+    // for keeping them in "data".
+    std::map<std::string, NDArray>* arrays = nullptr;
+    KeyIndex<NDArray>* array_index = nullptr;
+    MapRefill* array_refill = nullptr;
+    // buffers, must be set with "arrays"
+    std::vector<std::size_t>* shape = nullptr;
+    AlignedBuffers* buffers = nullptr;
+
+    // owner of the memory the data refer to, nullptr for none
+    std::shared_ptr<const void> owner;
+
+    explicit FillTarget(ObjectMap& data) : data(&data) {}
+};
+
+/*
+ * Cached layout of the "msgpack" data of a source.
+ *
+ * It is shared by the client and the kb_data of the source, which decodes
+ * its data lazily, possibly in another thread. If the keys are the same
+ * as those of the previous train, the data are inserted in the cached
+ * order without parsing the keys.
+ */
+class LayoutSlot {
+
+    std::shared_ptr<const DataLayout> layout_; // guarded by mutex_
+    std::mutex mutex_;
+
+    // selects the keys to be inserted, empty for all the keys
+    std::function<bool(const std::string&)> select_;
+
+    // nullptr if the keys are not interned
+    std::shared_ptr<KeyTable> keys_;
+
+    std::atomic<std::size_t> hits_;
+    std::atomic<std::size_t> misses_;
+
+    static bool keyEquals(const msgpack::object& key, const std::string& expected) {
+        if (key.type == msgpack::type::STR)
+            return key.via.str.size == expected.size()
+                && std::memcmp(key.via.str.ptr, expected.data(), expected.size()) == 0;
+        if (key.type == msgpack::type::BIN)
+            return key.via.bin.size == expected.size()
+                && std::memcmp(key.via.bin.ptr, expected.data(), expected.size()) == 0;
+        return false;
+    }
+
+    static bool matches(const DataLayout& layout, const msgpack::object_map& data) {
+        if (layout.keys.size() != data.size) return false;
+        for (std::size_t i = 0; i < data.size; ++i) {
+            if (!keyEquals(data.ptr[i].key, layout.keys[i])) return false;
+        }
+        return true;
+    }
+
+    // Return nullptr if the keys are duplicated.
+    std::shared_ptr<const DataLayout> makeLayout(const msgpack::object_map& data) const {
+        auto layout = std::make_shared<DataLayout>();
+        auto& keys = layout->keys;
+        keys.reserve(data.size);
+        for (std::size_t i = 0; i < data.size; ++i) keys.push_back(data.ptr[i].key.as<std::string>());
+        if (keys_) {
+            layout->ids.reserve(data.size);
+            for (auto& key : keys) layout->ids.push_back(keys_->intern(key));
+        }
+
+        layout->order.resize(data.size);
+        for (std::size_t i = 0; i < data.size; ++i) layout->order[i] = i;
+        std::sort(layout->order.begin(), layout->order.end(),
+                  [&keys](std::size_t a, std::size_t b) { return keys[a] < keys[b]; });
+
+        // duplicated keys cannot be inserted in sorted order
+        for (std::size_t i = 1; i < data.size; ++i) {
+            if (keys[layout->order[i - 1]] == keys[layout->order[i]]) return nullptr;
+        }
+
+        // the keys are set in the flat index in the order of their ids
+        if (keys_) {
+            auto& ids = layout->ids;
+            std::sort(layout->order.begin(), layout->order.end(),
+                      [&ids](std::size_t a, std::size_t b) { return ids[a].id() < ids[b].id(); });
+        }
+
+        if (select_) {
+            auto& order = layout->order;
+            order.erase(std::remove_if(order.begin(), order.end(),
+                                       [&](std::size_t idx) { return !select_(keys[idx]); }),
+                        order.end());
+        }
+        return layout;
+    }
+
+    // Return true if "value" is an array encoded by msgpack-numpy, which is set in target.arrays.
+    static bool promote(const msgpack::object& value,
+                        const std::string& key,
+                        const Key* id,
+                        const FillTarget& target) {
+        void* ptr = nullptr;
+        auto dtype = numpyArray(value, ptr, *target.shape);
+        if (!dtype) return false;
+
+        auto& array = (*target.array_refill)(*target.arrays, key);
+        // the bytes are only aligned to their type if the sender padded them
+        auto item_size = karabo_bridge::itemSize(dtype->dtype);
+        if (reinterpret_cast<std::uintptr_t>(ptr) % item_size != 0) {
+            std::size_t size = item_size;
+            for (auto dim : *target.shape) size *= dim;
+            auto buffer = target.buffers->copy(ptr, size);
+            array.assign(buffer->data(), *target.shape, dtype->dtype, buffer);
+        } else {
+            array.assign(ptr, *target.shape, dtype->dtype, target.owner);
+        }
+        if (id && target.array_index) target.array_index->set(*id, &array);
+        return true;
+    }
+
+public:
+    /*
+     * Constructor.
+     *
+     * @param select: returns true for the keys to be inserted. Empty
+     *                (default) for all the keys.
+     * @param keys: table in which the keys are interned. nullptr (default)
+     *              for not interning the keys.
+     */
+    explicit LayoutSlot(std::function<bool(const std::string&)> select=nullptr,
+                        std::shared_ptr<KeyTable> keys=nullptr)
+        : select_(std::move(select)),
+          keys_(std::move(keys)),
+          hits_(0),
+          misses_(0) {}
+
+    LayoutSlot(const LayoutSlot&) = delete;
+    LayoutSlot& operator=(const LayoutSlot&) = delete;
+
+    /*
+     * Fill "map" with the unpacked "msgpack" data of the source. The nodes
+     * of the keys already in the map are reused and the other entries are
+     * erased.
+     *
+     * @param index: flat index of the data by interned key. Only filled if
+     *               the slot has a key table.
+     * @param refill: state of the refill, which keeps its memory across
+     *                trains. nullptr (default) for a temporary one.
+     *
+     * Exceptions:
+     * msgpack::type_error if the data is not a map of strings
+     */
+    void fill(const msgpack::object& data,
+              ObjectMap& map,
+              KeyIndex<MsgpackObject>* index=nullptr,
+              MapRefill* refill=nullptr) {
+        FillTarget target(map);
+        target.data_index = index;
+        target.data_refill = refill;
+        fill(data, target);
+    }
+
+    /*
+     * Fill the maps of "target" with the unpacked "msgpack" data of the
+     * source, see above. The data arrays are not copied.
+     *
+     * Exceptions:
+     * msgpack::type_error if the data is not a map of strings
+     */
+    void fill(const msgpack::object& data, const FillTarget& target) {
+        if (data.type != msgpack::type::MAP) throw msgpack::type_error();
+
+        MapRefill tmp_refill;
+        auto& refill = target.data_refill ? *target.data_refill : tmp_refill;
+        auto& map = *target.data;
+        auto index = keys_ ? target.data_index : nullptr;
+
+        std::shared_ptr<const DataLayout> layout;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            layout = layout_;
+        }
+
+        if (layout && matches(*layout, data.via.map)) {
+            ++hits_;
+            bool interned = !layout->ids.empty();
+            refill.start();
+            for (auto idx : layout->order) {
+                auto& val = data.via.map.ptr[idx].val;
+                auto id = interned ? &layout->ids[idx] : nullptr;
+                if (target.arrays && promote(val, layout->keys[idx], id, target)) continue;
+                auto& value = refill(map, layout->keys[idx]);
+                value.assign(val, target.owner);
+                if (id && index) index->set(*id, &value);
+            }
+            refill.finish(map);
+            return;
+        }
+        ++misses_;
+
+        // check the keys before modifying the map
+        for (std::size_t i = 0; i < data.via.map.size; ++i) {
+            auto type = data.via.map.ptr[i].key.type;
+            if (type != msgpack::type::STR && type != msgpack::type::BIN) throw msgpack::type_error();
+        }
+
+        refill.start();
+        for (std::size_t i = 0; i < data.via.map.size; ++i) {
+            auto& kv = data.via.map.ptr[i];
+            auto key = kv.key.as<std::string>();
+            if (select_ && !select_(key)) continue;
+
+            Key id(0);
+            bool interned = keys_ && (index || target.array_index);
+            if (interned) id = keys_->intern(key);
+            if (target.arrays && promote(kv.val, key, interned ? &id : nullptr, target)) continue;
+            auto& value = refill(map, key);
+            value.assign(kv.val, target.owner);
+            if (index) index->set(id, &value);
+        }
+        refill.finish(map);
+
+        auto layout_new = makeLayout(data.via.map);
+        std::lock_guard<std::mutex> lock(mutex_);
+        layout_ = std::move(layout_new);
+    }
+
+    std::size_t hits() const { return hits_; }
+
+    std::size_t misses() const { return misses_; }
+};
+
+/*
+ * Cache of the structure of the trains, which rarely changes from one
+ * train to the next.
+ *
+ * - Headers of array data are cached by their bytes, so that they are
+ *   only decoded once.
+ * - The keys of the "msgpack" data are cached per source, see LayoutSlot.
+ */
+class SchemaCache {
+
+public:
+    // decoded header of array data
+    struct ArrayHeader {
+        std::string bytes; // used to verify a cache hit
+        std::string source;
+        std::string path;
+        Key key = Key(0); // interned path
+        std::string dtype; // C++ type
+        DType dtype_id = DType::UNKNOWN; // parsed from dtype
+        std::vector<std::size_t> shape;
+    };
+
+private:
+    std::unordered_map<uint64_t, ArrayHeader> headers_;
+    std::unordered_map<std::string, std::shared_ptr<LayoutSlot>> layouts_;
+    std::shared_ptr<KeyTable> keys_;
+
+    // bound of the number of cached headers, e.g. if the shapes keep changing
+    static constexpr std::size_t MAX_HEADERS = 4096;
+
+    // 64-bit FNV-1a hash
+    static uint64_t hash(const char* data, std::size_t size) {
+        uint64_t h = 14695981039346656037ULL;
+        for (std::size_t i = 0; i < size; ++i) {
+            h ^= static_cast<unsigned char>(data[i]);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+public:
+    explicit SchemaCache(std::shared_ptr<KeyTable> keys=nullptr)
+        : keys_(keys ? std::move(keys) : std::make_shared<KeyTable>()) {}
+
+    // the keys are interned in this table, which is kept by clear()
+    const std::shared_ptr<KeyTable>& keys() const { return keys_; }
+
+    /*
+     * Return the cached header with the given bytes, or nullptr.
+     */
+    const ArrayHeader* findHeader(const char* data, std::size_t size) const {
+        auto it = headers_.find(hash(data, size));
+        if (it == headers_.end()) return nullptr;
+        auto& bytes = it->second.bytes;
+        if (bytes.size() != size || std::memcmp(bytes.data(), data, size) != 0) return nullptr;
+        return &it->second;
+    }
+
+    // The path of the header is interned.
+    const ArrayHeader& addHeader(ArrayHeader&& header) {
+        if (headers_.size() >= MAX_HEADERS) headers_.clear();
+        header.key = keys_->intern(header.path);
+        auto h = hash(header.bytes.data(), header.bytes.size());
+        return headers_[h] = std::move(header);
+    }
+
+    /*
+     * Return the layout slot of a source, which is created if necessary.
+     *
+     * @param filter: selects the keys of the new slot.
+     */
+    std::shared_ptr<LayoutSlot> layout(const std::string& source,
+                                       const SourceFilter& filter=SourceFilter()) {
+        auto& slot = layouts_[source];
+        if (!slot) {
+            if (filter.selectsAllKeys(source)) slot = std::make_shared<LayoutSlot>(nullptr, keys_);
+            else
+                slot = std::make_shared<LayoutSlot>([filter, source](const std::string& key) {
+                    return filter.selectsKey(source, key);
+                }, keys_);
+        }
+        return slot;
+    }
+
+    // total number of the "msgpack" data decoded with a cached layout
+    std::size_t layoutHits() const {
+        std::size_t n = 0;
+        for (auto& v : layouts_) n += v.second->hits();
+        return n;
+    }
+
+    // total number of the "msgpack" data whose keys were parsed
+    std::size_t layoutMisses() const {
+        std::size_t n = 0;
+        for (auto& v : layouts_) n += v.second->misses();
+        return n;
+    }
+
+    void clear() {
+        headers_.clear();
+        layouts_.clear();
+    }
+};
+
+} // detail
+
+struct kb_data;
+
+/*
+ * Map of the array data of a kb_data by path.
+ *
+ * The entries are set by the client, see kb_data::setArray(). They cannot
+ * be inserted or erased otherwise, so that the flat index of the kb_data
+ * (see kb_data::findArray()) never refers to a stale entry. The arrays
+ * themselves can be modified.
+ *
+ * The arrays encoded by msgpack-numpy in the "msgpack" data are only found
+ * by decoding them. Any access to the map therefore decodes the data of
+ * the kb_data first, see kb_data::decode(). Decoding errors are raised
+ * accordingly.
+ */
+class ArrayMap {
+    friend struct kb_data;
+
+    // set by kb_data::decode() const, which is synchronized
+    mutable std::map<std::string, NDArray> map_;
+    const kb_data* owner_; // nullptr for a copy
+
+    explicit ArrayMap(const kb_data* owner) : owner_(owner) {}
+
+    void decode() const;
+
+public:
+    using iterator = std::map<std::string, NDArray>::iterator;
+    using const_iterator = std::map<std::string, NDArray>::const_iterator;
+
+    // A copy holds the decoded arrays without being attached to the kb_data.
+    ArrayMap(const ArrayMap& other) : owner_(nullptr) {
+        other.decode();
+        map_ = other.map_;
+    }
+    ArrayMap& operator=(const ArrayMap&) = delete;
+
+    /*
+     * Access the array data of a path.
+     *
+     * Exceptions:
+     * std::out_of_range if the path does not exist
+     */
+    NDArray& operator[](const std::string& path) { return at(path); }
+    const NDArray& operator[](const std::string& path) const { return at(path); }
+
+    NDArray& at(const std::string& path) { decode(); return map_.at(path); }
+    const NDArray& at(const std::string& path) const { decode(); return map_.at(path); }
+
+    iterator find(const std::string& path) { decode(); return map_.find(path); }
+    const_iterator find(const std::string& path) const { decode(); return map_.find(path); }
+
+    std::size_t count(const std::string& path) const { decode(); return map_.count(path); }
+
+    // Not noexcept since the first access decodes the data.
+    iterator begin() { decode(); return map_.begin(); }
+    iterator end() { decode(); return map_.end(); }
+    const_iterator begin() const { decode(); return map_.begin(); }
+    const_iterator end() const { decode(); return map_.end(); }
+    const_iterator cbegin() const { decode(); return map_.cbegin(); }
+    const_iterator cend() const { decode(); return map_.cend(); }
+
+    std::size_t size() const { decode(); return map_.size(); }
+
+    bool empty() const { decode(); return map_.empty(); }
+};
+
+/*
+ * Data structure presented to the user.
+ *
+ * - The data member "metadata" holds a map of meta data;
+ * - The data member "array" holds a map of array data, which is usually a
+ *   big chunk of data;
+ * - The data member "data_" holds a map of normal data, which can be either
+ *   scalar data or small arrays.
+ *
+ * The normal data are decoded lazily on the first access, i.e. operator[],
+ * iteration, insert() or any access to "array", so that a source which
+ * is never accessed only costs the receive. Decoding errors are therefore
+ * raised on the first access. The decoding is synchronized, so that a const kb_data can be
+ * read by several threads concurrently, while a non-const access must not
+ * be concurrent with any other access.
+ *
+ * A kb_data can be recycled for the data of the same source in the next
+ * train (see Client::next(data_pkg)), which reuses the nodes of its maps,
+ * its vectors and the zones the frames are unpacked into.
+ */
+struct kb_data {
+    kb_data() : array(this) {}
+
+    ~kb_data() = default;
+
+    kb_data(const kb_data&) = delete;
+    kb_data& operator=(const kb_data&) = delete;
+
+    // the mutex guarding the decoding is not moved
+    kb_data(kb_data&& other) noexcept : kb_data() { swap(other); }
+    kb_data& operator=(kb_data&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    using iterator = ObjectMap::iterator;
+    using const_iterator = ObjectMap::const_iterator;
+
+    ObjectMap metadata;
+    // also holds the arrays encoded by msgpack-numpy in the "msgpack" data,
+    // which are set when the data are decoded
+    ArrayMap array;
+
+    MsgpackObject& operator[](const std::string& key) {
+        decode();
+        return data_.at(key);
+    }
+
+    /*
+     * Access the data by an interned key of the client which received it.
+     *
+     * Exceptions:
+     * std::out_of_range if the key does not exist
+     */
+    MsgpackObject& operator[](Key key) {
+        auto ptr = find(key);
+        if (!ptr) throw std::out_of_range("Key not found!");
+        return *ptr;
+    }
+
+    /*
+     * Return the data of an interned key, or nullptr if it does not exist.
+     *
+     * The keys are interned in the key table of the kb_data, see
+     * setKeyTable().
+     */
+    MsgpackObject* find(Key key) {
+        decode();
+        return data_index_.find(key);
+    }
+
+    // Return the array data of an interned key, or nullptr if it does not exist.
+    NDArray* findArray(Key key) {
+        decode();
+        return array_index_.find(key);
+    }
+
+    /*
+     * Set the table in which the keys of find() and findArray() are
+     * interned. The client sets its own table. Without a table (default),
+     * only the data set by a client are indexed.
+     */
+    void setKeyTable(const std::shared_ptr<KeyTable>& keys) {
+        if (keys_ != keys) keys_ = keys;
+    }
+
+    // Not noexcept since the first access decodes the data, see decode().
+    iterator begin() { decode(); return data_.begin(); }
+    iterator end() { decode(); return data_.end(); }
+    const_iterator begin() const { decode(); return data_.begin(); }
+    const_iterator end() const { decode(); return data_.end(); }
+    const_iterator cbegin() const { decode(); return data_.cbegin(); }
+    const_iterator cend() const { decode(); return data_.cend(); }
+
+    template<typename T>
+    std::pair<iterator, bool> insert(T&& value) {
+        decode();
+        auto result = data_.insert(std::forward<T>(value));
+        if (result.second) indexData(result.first);
+        return result;
+    }
+
+    // insert with a hint, e.g. end() when inserting in sorted order
+    template<typename T>
+    iterator insert(const_iterator hint, T&& value) {
+        decode();
+        auto size = data_.size();
+        auto it = data_.insert(hint, std::forward<T>(value));
+        if (data_.size() != size) indexData(it);
+        return it;
+    }
+
+    std::size_t bytesReceived() const {
+        std::size_t size_ = 0;
+        for (std::size_t i = 0; i < n_frames_; ++i) size_ += frames_[i]->msg.size();
+        return size_;
+    }
+
+    /*
+     * Append a frame and return it. The frame does not move any more, i.e.
+     * its data can be referred to until the kb_data is recycled.
+     */
+    const zmq::message_t& appendMsg(zmq::message_t&& msg) {
+        return appendFrame(std::move(msg)).msg;
+    }
+
+    // Return the owner of the frame appended last, see Object::owner().
+    std::shared_ptr<const void> lastFrame() const {
+        if (n_frames_ == 0) return nullptr;
+        return frames_[n_frames_ - 1];
+    }
+
+    void appendHandle(msgpack::object_handle&& oh) {
+        handles_.push_back(std::move(oh));
+    }
+
+    /*
+     * Append a header frame and return it unpacked. The unpacked header
+     * refers to the frame and lives as long as the data.
+     *
+     * Exceptions:
+     * msgpack::unpack_error if the header is not valid msgpack
+     */
+    msgpack::object appendHeader(zmq::message_t&& msg) {
+        auto& frame = appendFrame(std::move(msg));
+        return frame.zone.unpack(frame.msg);
+    }
+
+    /*
+     * Append a header frame which has already been unpacked into "zone".
+     * The zone is swapped with the released one of the frame, so that the
+     * unpacked header lives as long as the data.
+     */
+    void appendHeader(zmq::message_t&& msg, detail::ReusableZone& zone) {
+        auto& frame = appendFrame(std::move(msg));
+        std::swap(frame.zone, zone);
+    }
+
+    /*
+     * Set the metadata from an unpacked header. The nodes of the keys
+     * already in the metadata are reused.
+     *
+     * @param owner: owner of the memory of the header, nullptr (default)
+     *               for none.
+     *
+     * Exceptions:
+     * std::out_of_range if the header does not contain "metadata"
+     * msgpack::type_error if the header or the metadata is not a map of strings
+     */
+    void setMetadata(const msgpack::object& header, const std::shared_ptr<const void>& owner=nullptr) {
+        if (header.type != msgpack::type::MAP) throw msgpack::type_error();
+
+        const msgpack::object* data = nullptr;
+        for (std::size_t i = 0; i < header.via.map.size; ++i) {
+            auto& kv = header.via.map.ptr[i];
+            if (kv.key.as<StringView>() == "metadata") data = &kv.val;
+        }
+        if (!data) throw std::out_of_range("Failed to parse the header: 'metadata' is not found!");
+        if (data->type != msgpack::type::MAP) throw msgpack::type_error();
+
+        metadata_refill_.start();
+        for (std::size_t i = 0; i < data->via.map.size; ++i) {
+            auto& kv = data->via.map.ptr[i];
+            auto key = kv.key.as<StringView>();
+            // the map can only be searched with a string
+            key_.assign(key.data(), key.size());
+            metadata_refill_(metadata, key_).assign(kv.val, owner);
+        }
+        metadata_refill_.finish(metadata);
+        has_metadata_ = true;
+    }
+
+    /*
+     * Set the array data of a path. The node of the path and the shape are
+     * reused if the path is already in "array".
+     *
+     * @param owner: owner of the memory of the data, e.g. lastFrame().
+     *               nullptr (default) for none.
+     */
+    NDArray& setArray(const std::string& path,
+                      void* ptr,
+                      const std::vector<std::size_t>& shape,
+                      DType dtype,
+                      std::shared_ptr<const void> owner=nullptr) {
+        auto& value = array_refill_(array.map_, path);
+        value.assign(ptr, shape, dtype, std::move(owner));
+        if (keys_) array_index_.set(keys_->intern(path), &value);
+        return value;
+    }
+
+    // dtype is the name of a C++ type, e.g. "uint16_t"
+    NDArray& setArray(const std::string& path,
+                      void* ptr,
+                      const std::vector<std::size_t>& shape,
+                      const std::string& dtype,
+                      std::shared_ptr<const void> owner=nullptr) {
+        auto& value = array_refill_(array.map_, path);
+        value.assign(ptr, shape, dtype, std::move(owner));
+        if (keys_) array_index_.set(keys_->intern(path), &value);
+        return value;
+    }
+
+    /*
+     * Set the array data described by a cached header, whose path has
+     * already been interned in the key table of the kb_data.
+     */
+    NDArray& setArray(const detail::SchemaCache::ArrayHeader& header,
+                      void* ptr,
+                      std::shared_ptr<const void> owner=nullptr) {
+        auto& value = array_refill_(array.map_, header.path);
+        // the name is only needed for a type which is not supported
+        if (header.dtype_id == DType::UNKNOWN)
+            value.assign(ptr, header.shape, header.dtype, std::move(owner));
+        else
+            value.assign(ptr, header.shape, header.dtype_id, std::move(owner));
+        array_index_.set(header.key, &value);
+        return value;
+    }
+
+    /*
+     * Append the "msgpack" data frame, which is decoded on the first
+     * access with the layout cached in "layout". The data replace those
+     * of the previous frame.
+     */
+    void appendLazyData(zmq::message_t&& msg, std::shared_ptr<detail::LayoutSlot> layout) {
+        decode();
+        appendFrame(std::move(msg));
+        lazy_idx_ = n_frames_ - 1;
+        layout_ = std::move(layout);
+        lazy_ = true;
+        has_data_ = true;
+    }
+
+    // Return true if the normal data are waiting to be decoded.
+    bool isLazy() const { return lazy_.load(std::memory_order_acquire); }
+
+    /*
+     * Decode the normal data now instead of on the first access. The data
+     * are decoded once, also if several threads access them concurrently.
+     *
+     * Exceptions:
+     * msgpack::type_error if the data is not a map of strings
+     */
+    void decode() const {
+        if (!isLazy()) return;
+        std::lock_guard<std::mutex> lock(decode_mutex_);
+        if (!layout_) return;
+
+        // the strings and binary data refer to the frame or its zone
+        auto& frame = frames_[lazy_idx_];
+        auto data = frame->zone.unpack(frame->msg);
+        detail::FillTarget target(data_);
+        // the entries which are not filled again are erased
+        data_index_.clear();
+        target.data_index = &data_index_;
+        target.data_refill = &data_refill_;
+        target.arrays = &array.map_;
+        target.array_index = &array_index_;
+        target.array_refill = &array_refill_;
+        target.shape = &shape_;
+        target.buffers = &aligned_;
+        target.owner = frame;
+        layout_->fill(data, target);
+        layout_ = nullptr;
+        lazy_.store(false, std::memory_order_release);
+    }
+
+    /*
+     * Release the frames in order to refill the kb_data with the data of
+     * the next train, while keeping its memory. The data must not be
+     * accessed until finishRefill() has been called.
+     *
+     * The frames which are still shared by copies of the objects, e.g. an
+     * NDArray handed to another thread, are left to them.
+     */
+    void recycle() {
+        for (auto& v : metadata) v.second.resetOwner();
+        for (auto& v : array.map_) v.second.resetOwner();
+        for (auto& v : data_) v.second.resetOwner();
+        aligned_.recycle();
+        for (std::size_t i = 0; i < n_frames_; ++i) {
+            auto& frame = frames_[i];
+            if (frame.use_count() == 1) {
+                frame->msg.rebuild();
+                frame->zone.clear();
+            } else {
+                frame.reset();
+            }
+        }
+        n_frames_ = 0;
+        handles_.clear();
+        layout_ = nullptr;
+        lazy_ = false;
+        data_index_.clear();
+        array_index_.clear();
+        array_refill_.start();
+        has_metadata_ = false;
+        has_data_ = false;
+        recycled_ = true;
+    }
+
+    // Return true if the kb_data has been recycled and not refilled yet.
+    bool isRecycled() const { return recycled_; }
+
+    /*
+     * Erase the data which have not been set again since recycle().
+     */
+    void finishRefill() {
+        array_refill_.finish(array.map_);
+        if (!has_metadata_) metadata.clear();
+        if (!has_data_) data_.clear();
+        recycled_ = false;
+    }
+
+    void swap(kb_data& other) {
+        metadata.swap(other.metadata);
+        array.map_.swap(other.array.map_);
+        data_.swap(other.data_);
+        frames_.swap(other.frames_);
+        std::swap(n_frames_, other.n_frames_);
+        handles_.swap(other.handles_);
+        std::swap(lazy_idx_, other.lazy_idx_);
+        layout_.swap(other.layout_);
+        bool lazy = lazy_;
+        lazy_ = other.lazy_.load();
+        other.lazy_ = lazy;
+        data_index_.swap(other.data_index_);
+        array_index_.swap(other.array_index_);
+        keys_.swap(other.keys_);
+        std::swap(metadata_refill_, other.metadata_refill_);
+        std::swap(array_refill_, other.array_refill_);
+        std::swap(data_refill_, other.data_refill_);
+        key_.swap(other.key_);
+        shape_.swap(other.shape_);
+        aligned_.swap(other.aligned_);
+        std::swap(has_metadata_, other.has_metadata_);
+        std::swap(has_data_, other.has_data_);
+        std::swap(recycled_, other.recycled_);
+    }
+
+private:
+    void indexData(iterator it) {
+        if (keys_) data_index_.set(keys_->intern(it->first), &it->second);
+    }
+
+    // Append a frame, reusing the memory of a released one if possible.
+    detail::Frame& appendFrame(zmq::message_t&& msg) {
+        if (n_frames_ == frames_.size()) frames_.emplace_back();
+        auto& frame = frames_[n_frames_++];
+        if (!frame) frame = std::make_shared<detail::Frame>();
+        frame->msg = std::move(msg);
+        return *frame;
+    }
+
+    mutable ObjectMap data_;
+    // maintain the lifetime of data, the first n_frames_ are in use and
+    // the others are kept for reuse
+    std::vector<std::shared_ptr<detail::Frame>> frames_;
+    std::size_t n_frames_ = 0;
+    mutable std::vector<msgpack::object_handle> handles_; // maintain the lifetime of data
+
+    // index of the data frame in frames_ which is not decoded yet
+    std::size_t lazy_idx_ = 0;
+    // layout of the data frame, nullptr if there is nothing to decode
+    mutable std::shared_ptr<detail::LayoutSlot> layout_;
+    // The members changed by decode() are guarded by decode_mutex_.
+    // "lazy_" is set with "layout_" and checked without locking.
+    mutable std::mutex decode_mutex_;
+    mutable std::atomic<bool> lazy_{false};
+
+    // flat indices of the data by interned key, pointing into the maps
+    mutable detail::KeyIndex<MsgpackObject> data_index_;
+    mutable detail::KeyIndex<NDArray> array_index_;
+    // table the keys of the indices are interned in, nullptr for none
+    std::shared_ptr<KeyTable> keys_;
+
+    // reused when the kb_data is recycled
+    detail::MapRefill metadata_refill_;
+    mutable detail::MapRefill array_refill_;
+    mutable detail::MapRefill data_refill_;
+    std::string key_;
+    mutable std::vector<std::size_t> shape_;
+    mutable detail::AlignedBuffers aligned_;
+
+    // set since recycle()
+    bool has_metadata_ = false;
+    bool has_data_ = false;
+    bool recycled_ = false;
+};
+
+inline void ArrayMap::decode() const {
+    if (owner_) owner_->decode();
+}
+
+/*
+ * Convert a vector to a formatted string
+ */
+template <typename T>
+std::string vectorToString(const std::vector<T>& vec) {
+    if (vec.empty()) return "";
+
+    std::stringstream ss;
+    ss << "[";
+    for (std::size_t i=0; i<vec.size(); ++i) {
+        ss << vec[i];
+        if (i != vec.size() - 1) ss << ", ";
+    }
+    ss << "]";
+    return ss.str();
+}
+
+/*
+ * Convert the python type to the corresponding C++ type
+ */
+inline void toCppTypeString(std::string& dtype) {
+    if (dtype.find("int") != std::string::npos)
+        dtype.append("_t");
+    else if (dtype == "float32")
+        dtype = "float";
+    else if (dtype == "float64")
+        dtype = "double";
+}
+
+
+namespace detail {
+
+/*
+ * Fields of a header frame which are needed to decode the following data
+ * frame. The strings refer to the header frame, or to the zone it has been
+ * unpacked into for a small frame.
+ */
+struct FrameHeader {
+    static constexpr std::size_t MAX_NDIM = 8;
+
+    StringView content;
+    StringView source;
+    StringView path;
+    StringView dtype;
+    std::array<std::size_t, MAX_NDIM> shape;
+    std::size_t ndim = 0;
+    bool has_shape = false;
+    // the unpacked header, which the fields above may refer to
+    msgpack::object obj;
+};
+
+// Result of parsing a header frame.
+enum class HeaderStatus { OK, INVALID, NO_CONTENT, TOO_MANY_DIMS };
+
+// Return the error message of a header which failed to parse.
+inline std::string headerError(HeaderStatus status) {
+    switch (status) {
+        case HeaderStatus::OK:
+            return "";
+        case HeaderStatus::INVALID:
+            return "Failed to parse the header: it is not a msgpack map or its 'shape' is invalid!";
+        case HeaderStatus::NO_CONTENT:
+            return "Failed to parse the header: 'content' is not found!";
+        case HeaderStatus::TOO_MANY_DIMS:
+            return "Failed to parse the header: 'shape' has more than "
+                   + std::to_string(FrameHeader::MAX_NDIM) + " dimensions!";
+    }
+    return "";
+}
+
+/*
+ * Extract the fields of FrameHeader from an unpacked header.
+ *
+ * The header is parsed in one pass over the unpacked map. Only the header
+ * of "msgpack" data is used further, i.e. for its metadata.
+ */
+inline HeaderStatus parseHeader(const msgpack::object& obj, FrameHeader& header) {
+    header.obj = obj;
+    if (obj.type != msgpack::type::MAP) return HeaderStatus::INVALID;
+
+    for (std::size_t i = 0; i < obj.via.map.size; ++i) {
+        auto& kv = obj.via.map.ptr[i];
+        if (kv.key.type != msgpack::type::STR && kv.key.type != msgpack::type::BIN) continue;
+        auto key = kv.key.as<StringView>();
+
+        if (key == "shape") {
+            if (kv.val.type != msgpack::type::ARRAY) continue;
+            auto& shape = kv.val.via.array;
+            // an array with more dimensions is not supported
+            if (shape.size > FrameHeader::MAX_NDIM) return HeaderStatus::TOO_MANY_DIMS;
+            header.has_shape = true;
+            header.ndim = 0;
+            for (std::size_t j = 0; j < shape.size; ++j) {
+                // e.g. a negative dimension
+                if (shape.ptr[j].type != msgpack::type::POSITIVE_INTEGER) return HeaderStatus::INVALID;
+                header.shape[header.ndim++] = static_cast<std::size_t>(shape.ptr[j].via.u64);
+            }
+            continue;
+        }
+
+        if (kv.val.type != msgpack::type::STR && kv.val.type != msgpack::type::BIN) continue;
+        auto value = kv.val.as<StringView>();
+        if (key == "content") header.content = value;
+        else if (key == "source") header.source = value;
+        else if (key == "path") header.path = value;
+        else if (key == "dtype") header.dtype = value;
     }
+    return header.content.empty() ? HeaderStatus::NO_CONTENT : HeaderStatus::OK;
+}
 
-    void appendMsg(zmq::message_t&& msg) {
-        mpmsg_.push_back(std::move(msg));
+/*
+ * Unpack a header frame into "zone" and parse it into "header". The zone
+ * must not be cleared while the header is used. It is cleared first, i.e.
+ * the header of the previous call becomes invalid.
+ */
+inline HeaderStatus parseHeader(const zmq::message_t& msg, ReusableZone& zone, FrameHeader& header) {
+    zone.clear();
+    try {
+        return parseHeader(zone.unpack(msg), header);
+    } catch (msgpack::unpack_error&) {
+        return HeaderStatus::INVALID;
     }
+}
 
-    void appendHandle(msgpack::object_handle&& oh) {
-        handles_.push_back(std::move(oh));
+/*
+ * Read "timestamp.tid" from the metadata of an unpacked header.
+ *
+ * Return false if it is not found.
+ */
+inline bool headerTrainId(const msgpack::object& obj, uint64_t& tid) {
+    if (obj.type != msgpack::type::MAP) return false;
+    for (std::size_t i = 0; i < obj.via.map.size; ++i) {
+        auto& kv = obj.via.map.ptr[i];
+        if (kv.key.type != msgpack::type::STR || kv.key.as<StringView>() != "metadata"
+                || kv.val.type != msgpack::type::MAP) continue;
+        auto& metadata = kv.val.via.map;
+        for (std::size_t j = 0; j < metadata.size; ++j) {
+            auto& item = metadata.ptr[j];
+            if (item.key.type == msgpack::type::STR
+                    && item.key.as<StringView>() == "timestamp.tid"
+                    && item.val.type == msgpack::type::POSITIVE_INTEGER) {
+                tid = item.val.via.u64;
+                return true;
+            }
+        }
     }
+    return false;
+}
 
-    void swap(kb_data& other) {
-        metadata.swap(other.metadata);
-        array.swap(other.array);
-        data_.swap(other.data_);
-        mpmsg_.swap(other.mpmsg_);
-        handles_.swap(other.handles_);
+/*
+ * Return the size in bytes of an element of the given numpy type, e.g.
+ * "uint16", or 0 if it is unknown.
+ */
+inline std::size_t itemSize(const StringView& dtype) {
+    if (dtype == "bool") return 1;
+    // the type name ends with the number of bits
+    std::size_t bits = 0;
+    std::size_t scale = 1;
+    for (std::size_t i = dtype.size(); i > 0 && isdigit(dtype[i - 1]); --i) {
+        bits += scale * (dtype[i - 1] - '0');
+        scale *= 10;
     }
+    return bits / 8;
+}
 
-private:
-    ObjectMap data_;
-    std::vector<zmq::message_t> mpmsg_; // maintain the lifetime of data
-    std::vector<msgpack::object_handle> handles_; // maintain the lifetime of data
-};
+} // detail
 
 /*
- * Convert a vector to a formatted string
+ * Messaging pattern of the connection to the bridge server.
+ *
+ * - REQ: request the data with "next" (the server runs in "REP" mode);
+ * - PULL: receive the data pushed by the server (the server runs in "PUSH" mode);
+ * - SUB: receive the data published by the server (the server runs in "PUB" mode).
  */
-template <typename T>
-std::string vectorToString(const std::vector<T>& vec) {
-    if (vec.empty()) return "";
+enum class SocketType { REQ, PULL, SUB };
 
-    std::stringstream ss;
-    ss << "[";
-    for (std::size_t i=0; i<vec.size(); ++i) {
-        ss << vec[i];
-        if (i != vec.size() - 1) ss << ", ";
+/*
+ * Create a zmq context.
+ *
+ * @param io_threads: number of I/O threads.
+ * @param affinity: CPUs to which the I/O threads are pinned. Empty for no pinning.
+ *
+ * Exceptions:
+ * zmq::error_t if the affinity cannot be set
+ * std::runtime_error if pinning is not supported by libzmq (< 4.3)
+ */
+inline std::shared_ptr<zmq::context_t> createContext(int io_threads=1,
+                                                     const std::vector<int>& affinity={}) {
+    auto ctx = std::make_shared<zmq::context_t>(io_threads);
+    for (auto cpu : affinity) {
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+        // must be set before the I/O threads are started by the first socket
+        if (zmq_ctx_set(static_cast<void*>(*ctx), ZMQ_THREAD_AFFINITY_CPU_ADD, cpu) != 0)
+            throw zmq::error_t();
+#else
+        (void)cpu;
+        throw std::runtime_error("Pinning zmq I/O threads requires libzmq >= 4.3!");
+#endif
     }
-    ss << "]";
-    return ss.str();
+    return ctx;
 }
 
 /*
- * Convert the python type to the corresponding C++ type
+ * Options of Client.
  */
-inline void toCppTypeString(std::string& dtype) {
-    if (dtype.find("int") != std::string::npos)
-        dtype.append("_t");
-    else if (dtype == "float32")
-        dtype = "float";
-    else if (dtype == "float64")
-        dtype = "double";
-}
-
+struct ClientOptions {
+    // messaging pattern of the server
+    SocketType type = SocketType::REQ;
+    // receive timeout in second, negative for infinite
+    double timeout = -1.;
+    // maximum number of "next" requests in flight, only for SocketType::REQ
+    std::size_t prefetch = 1;
+    // Only return the newest of the trains which have already arrived and
+    // discard the older ones without parsing them. It is ignored by a REQ
+    // client without prefetch, which never has more than one train in flight.
+    bool latest_only = false;
+
+    // Context shared by several clients. A new context is created for the
+    // client if it is not given.
+    std::shared_ptr<zmq::context_t> context;
+    // number of I/O threads of the new context
+    int io_threads = 1;
+    // CPUs to which the I/O threads of the new context are pinned, empty for no pinning
+    std::vector<int> io_thread_affinity;
+
+    // kernel receive buffer size in bytes (ZMQ_RCVBUF), -1 for the OS default
+    int rcvbuf = -1;
+    // maximum number of queued inbound messages (ZMQ_RCVHWM), 0 for no limit
+    int rcvhwm = 1000;
+    // maximum size of an inbound message in bytes (ZMQ_MAXMSGSIZE), -1 for no limit
+    int64_t max_msg_size = -1;
+
+    // TCP keepalive (ZMQ_TCP_KEEPALIVE): 1 to enable, 0 to disable, -1 for the OS default
+    int tcp_keepalive = -1;
+    // TCP keepalive idle time in second (ZMQ_TCP_KEEPALIVE_IDLE), -1 for the OS default
+    int tcp_keepalive_idle = -1;
+    // TCP keepalive interval in second (ZMQ_TCP_KEEPALIVE_INTVL), -1 for the OS default
+    int tcp_keepalive_interval = -1;
+    // number of TCP keepalive probes (ZMQ_TCP_KEEPALIVE_CNT), -1 for the OS default
+    int tcp_keepalive_count = -1;
+
+    // Sources and keys to be received. The data of the other sources and
+    // keys are released without being parsed. Empty for all the data.
+    SourceFilter filter;
+
+    // Table in which the keys are interned. It must be shared by clients
+    // whose data are accessed with the same Key handles. A new table is
+    // created for the client if it is not given.
+    std::shared_ptr<KeyTable> keys;
+
+    // Number of threads, in addition to the calling thread, which decode
+    // the sources of a train concurrently. 0 for decoding the sources
+    // lazily on the first access.
+    std::size_t parse_threads = 0;
+    // minimum size in bytes of a train to be decoded concurrently
+    std::size_t parse_threshold = 1 << 20;
+};
 
 /*
  * Karabo-bridge Client class.
  */
 class Client {
-    zmq::context_t ctx_;
+    std::shared_ptr<zmq::context_t> ctx_; // must outlive socket_
     zmq::socket_t socket_;
 
-    // Set to true if the client has sent request to the server to ask
-    // for data.
-    bool recv_ready_ = false;
+    SocketType type_;
+
+    // Maximum number of "next" requests which can be in flight. For
+    // SocketType::REQ, a REQ socket is used if it is 1 and a DEALER socket
+    // otherwise. It is 0 for the other socket types, which do not send any
+    // request.
+    std::size_t prefetch_;
+    // Number of "next" requests which have been sent to the server but
+    // whose replies have not been received yet.
+    std::size_t pending_ = 0;
+
+    // Set to true after the first subscription of a SUB socket.
+    bool subscribed_ = false;
+
+    bool latest_only_;
+    // number of trains discarded in the latest-only mode
+    std::size_t skipped_ = 0;
+
+    // train ID found in the filtered-out headers of the last message
+    uint64_t filtered_tid_ = 0;
+    bool has_filtered_tid_ = false;
+
+    SourceFilter filter_;
+
+    detail::SchemaCache schema_;
+
+    std::unique_ptr<detail::ThreadPool> parse_pool_; // nullptr for no parallel decoding
+    std::size_t parse_threshold_;
+    std::size_t schema_hits_ = 0;
+    std::size_t schema_misses_ = 0;
+
+    // buffers which keep their memory across trains
+    MultipartMsg recv_msg_;
+    MultipartMsg newer_msg_; // used in the latest-only mode
+    // zone the headers are unpacked into, which is swapped with the zone of
+    // the frame of a "msgpack" header to keep its metadata
+    detail::ReusableZone header_zone_;
+    std::string source_;
+    std::vector<kb_data*> lazy_sources_;
 
     /*
      * Send a "next" request to server.
      */
     void sendRequest() {
+        if (isDealer()) {
+            // A DEALER socket has to add the empty delimiter frame which
+            // is added implicitly by a REQ socket.
+            zmq::message_t delimiter;
+            socket_.send(delimiter, ZMQ_SNDMORE);
+        }
         zmq::message_t request(4);
         memcpy(request.data(), "next", request.size());
         socket_.send(request);
+        ++pending_;
+    }
+
+    bool isDealer() const { return type_ == SocketType::REQ && prefetch_ > 1; }
+
+    static int toZmqSocketType(SocketType type, std::size_t prefetch) {
+        switch (type) {
+            case SocketType::PULL: return ZMQ_PULL;
+            case SocketType::SUB: return ZMQ_SUB;
+            default: return prefetch > 1 ? ZMQ_DEALER : ZMQ_REQ;
+        }
+    }
+
+    static ClientOptions toOptions(SocketType type, double timeout, std::size_t prefetch) {
+        ClientOptions options;
+        options.type = type;
+        options.timeout = timeout;
+        options.prefetch = prefetch;
+        return options;
+    }
+
+    void setSocketOptions(const ClientOptions& options) {
+        socket_.setsockopt(ZMQ_RCVTIMEO,
+                           options.timeout < 0 ? -1 : static_cast<int>(1000 * options.timeout));
+        socket_.setsockopt(ZMQ_LINGER, 0);
+
+        if (options.rcvbuf >= 0) socket_.setsockopt(ZMQ_RCVBUF, options.rcvbuf);
+        socket_.setsockopt(ZMQ_RCVHWM, options.rcvhwm);
+        socket_.setsockopt(ZMQ_MAXMSGSIZE, options.max_msg_size);
+
+        socket_.setsockopt(ZMQ_TCP_KEEPALIVE, options.tcp_keepalive);
+        socket_.setsockopt(ZMQ_TCP_KEEPALIVE_IDLE, options.tcp_keepalive_idle);
+        socket_.setsockopt(ZMQ_TCP_KEEPALIVE_INTVL, options.tcp_keepalive_interval);
+        socket_.setsockopt(ZMQ_TCP_KEEPALIVE_CNT, options.tcp_keepalive_count);
+    }
+
+    /*
+     * Keep the number of in-flight "next" requests at prefetch_.
+     */
+    void requestNext() {
+        while (pending_ < prefetch_) sendRequest();
+    }
+
+    /*
+     * Keep enough "next" requests in flight for the "n" trains still
+     * expected in a batch. A REQ socket can only have one request in flight.
+     */
+    void requestBatch(std::size_t n) {
+        std::size_t window = isDealer() && n > prefetch_ ? n : prefetch_;
+        while (pending_ < window) sendRequest();
+    }
+
+    /*
+     * Wait until the socket becomes readable.
+     *
+     * @param timeout: timeout in millisecond, -1 for infinite.
+     *
+     * Return false on timeout.
+     */
+    bool waitReadable(long timeout) {
+        zmq::pollitem_t item = {static_cast<void*>(socket_), 0, ZMQ_POLLIN, 0};
+        return zmq::poll(&item, 1, timeout) > 0;
     }
 
     /*
      * Receive a multipart message from the server.
+     *
+     * @param flags: flags of the first zmq receive, e.g. ZMQ_DONTWAIT. The
+     *               remaining parts are always available once the first part
+     *               has arrived.
+     *
+     * Return false if no message arrived before timeout.
      */
-    MultipartMsg receiveMultipartMsg() {
+    bool receiveMultipartMsg(MultipartMsg& mpmsg, int flags=0) {
         int64_t more;  // multipart checker
-        MultipartMsg mpmsg;
+        bool first = true;
+        // true if the next part is the data of a header which is filtered out
+        bool skip = false;
         while (true) {
             zmq::message_t msg;
-            auto flag = socket_.recv(&msg);
-            if (!flag) throw ZmqTimeoutError();
+            bool keep = true;
+            auto flag = socket_.recv(&msg, first ? flags : 0);
+            if (!flag) return false;
+            if (first) has_filtered_tid_ = false;
+
+            if (skip) {
+                keep = false;
+                skip = false;
+            } else if (!filter_.empty() && isHeader(mpmsg.size())) {
+                auto cached = schema_.findHeader(static_cast<const char*>(msg.data()), msg.size());
+                detail::FrameHeader header;
+                if (cached) {
+                    if (!filter_.selectsKey(cached->source, cached->path)) {
+                        keep = false;
+                        skip = true;
+                    }
+                } else if (detail::parseHeader(msg, header_zone_, header) == detail::HeaderStatus::OK) {
+                    // an invalid header is left to decode()
+                    if (!selects(header)) {
+                        keep = false;
+                        skip = true;
+                        if (!has_filtered_tid_)
+                            has_filtered_tid_ = detail::headerTrainId(header.obj, filtered_tid_);
+                    }
+                }
+            }
+            first = false;
 
-            mpmsg.emplace_back(std::move(msg));
+            // a part which is filtered out is released immediately
+            if (keep) mpmsg.emplace_back(std::move(msg));
             std::size_t more_size = sizeof(int64_t);
             socket_.getsockopt(ZMQ_RCVMORE, &more, &more_size);
             if (more == 0) break;
         }
-        return mpmsg;
+
+        // remove the empty delimiter frame of the reply to a DEALER socket
+        if (isDealer() && !mpmsg.empty() && mpmsg.front().size() == 0)
+            mpmsg.erase(mpmsg.begin());
+        if (pending_ > 0) --pending_;
+
+        return true;
+    }
+
+    /*
+     * Return true if the part at the given position of a multipart message
+     * is a header.
+     */
+    bool isHeader(std::size_t idx) const {
+        // skip the empty delimiter frame of the reply to a DEALER socket
+        std::size_t offset = isDealer() ? 1 : 0;
+        return idx >= offset && (idx - offset) % 2 == 0;
+    }
+
+    static bool isArray(const detail::FrameHeader& header) {
+        return header.content == "array" || header.content == "ImageData";
+    }
+
+    /*
+     * Return true if the data following the header is selected by the
+     * filter: the source for "msgpack" data and the path for array data.
+     */
+    bool selects(const detail::FrameHeader& header) const {
+        if (isArray(header))
+            return filter_.selectsKey(header.source.data(), header.source.size(),
+                                      header.path.data(), header.path.size());
+        return filter_.selectsSource(header.source.data(), header.source.size());
+    }
+
+    /*
+     * Receive a multipart message from the server. In the latest-only mode,
+     * the messages which have already arrived are drained and only the
+     * newest one is kept.
+     *
+     * Return false if no message arrived before timeout.
+     */
+    bool receiveLatestMultipartMsg(MultipartMsg& mpmsg, int flags=0) {
+        if (!receiveMultipartMsg(mpmsg, flags)) return false;
+
+        if (latest_only_) {
+            auto& newer = newer_msg_;
+            newer.clear();
+            while (receiveMultipartMsg(newer, ZMQ_DONTWAIT)) {
+                mpmsg.swap(newer);
+                newer.clear(); // release the older message immediately
+                ++skipped_;
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Receive the next train into recv_msg_, see receiveLatestMultipartMsg().
+     */
+    bool receiveTrain(int flags=0) {
+        recv_msg_.clear();
+        return receiveLatestMultipartMsg(recv_msg_, flags);
     }
 
     /*
@@ -645,18 +2620,230 @@ class Client {
         ss << "\n";
     }
 
+    /*
+     * Insert the array data following "header" into "kbdt" and advance "it"
+     * past the (header, data) pair.
+     */
+    static void insertArray(kb_data& kbdt,
+                            const detail::SchemaCache::ArrayHeader& header,
+                            MultipartMsg::iterator& it) {
+        kbdt.appendMsg(std::move(*it));
+        std::advance(it, 1);
+
+        // The data are referred to after the frame has been appended, since
+        // a small message holds its data inline and moves them with it.
+        auto ptr = const_cast<void*>(kbdt.appendMsg(std::move(*it)).data());
+        std::advance(it, 1);
+
+        kbdt.setArray(header, ptr, kbdt.lastFrame());
+    }
+
+    /*
+     * Return the kb_data of a source to be refilled. The data of a source
+     * which appears twice in a train are decoded into "duplicate" and
+     * dropped.
+     */
+    kb_data& refillSource(std::map<std::string, kb_data>& data_pkg,
+                          const std::string& source,
+                          kb_data& duplicate) {
+        kb_data* kbdt = &duplicate;
+        auto it = data_pkg.lower_bound(source);
+        if (it == data_pkg.end() || it->first != source) {
+            kbdt = &data_pkg.emplace_hint(it, source, kb_data())->second;
+        } else if (!it->second.isRecycled()) {
+            duplicate.recycle();
+        } else {
+            kbdt = &it->second;
+        }
+        // the arrays are indexed by the keys interned in the schema cache
+        kbdt->setKeyTable(schema_.keys());
+        return *kbdt;
+    }
+
+    /*
+     * Parse a multipart message into "data_pkg", a map of kb_data keyed by
+     * source. The kb_data of the sources already in the map are recycled
+     * and the other sources are erased.
+     *
+     * Exceptions:
+     * std::runtime_error if unexpected message number or unknown "content" is found
+     */
+    void decode(MultipartMsg& mpmsg, std::map<std::string, kb_data>& data_pkg) {
+        if (mpmsg.size() % 2)
+            throw std::runtime_error(
+                "The multipart message is expected to contain (header, data) pairs!");
+
+        std::size_t total_size = 0;
+        for (auto& msg : mpmsg) total_size += msg.size();
+
+        for (auto& v : data_pkg) v.second.recycle();
+        try {
+            refill(mpmsg, data_pkg);
+        } catch (...) {
+            // the recycled data are not valid any more
+            data_pkg.clear();
+            throw;
+        }
+
+        if (parse_pool_ && data_pkg.size() > 1 && total_size >= parse_threshold_)
+            decodeParallel(data_pkg);
+    }
+
+    std::map<std::string, kb_data> decode(MultipartMsg& mpmsg) {
+        std::map<std::string, kb_data> data_pkg;
+        decode(mpmsg, data_pkg);
+        return data_pkg;
+    }
+
+    /*
+     * Refill the recycled "data_pkg" with a multipart message, see decode().
+     */
+    void refill(MultipartMsg& mpmsg, std::map<std::string, kb_data>& data_pkg) {
+        kb_data* kbdt = nullptr; // kb_data of the current source
+        kb_data duplicate;
+        bool is_initialized = false;
+        auto it = mpmsg.begin();
+        while(it != mpmsg.end()) {
+            auto header_data = static_cast<const char*>(it->data());
+            auto header_size = it->size();
+
+            auto cached = schema_.findHeader(header_data, header_size);
+            if (cached) {
+                ++schema_hits_;
+                if (!kbdt) kbdt = &refillSource(data_pkg, cached->source, duplicate);
+                insertArray(*kbdt, *cached, it);
+                continue;
+            }
+
+            // the header must contain "source" and "content"
+            detail::FrameHeader header;
+            auto status = detail::parseHeader(*it, header_zone_, header);
+            if (status != detail::HeaderStatus::OK)
+                throw std::runtime_error(detail::headerError(status));
+            if (header.source.empty())
+                throw std::runtime_error("Failed to parse the header: 'source' is not found!");
+
+            // the next message is the content (data)
+            if (header.content == "msgpack") {
+                // extracted before the header frame is moved
+                source_.assign(header.source.data(), header.source.size());
+
+                // array data before the first "msgpack" data belong to it
+                if (is_initialized || !kbdt) {
+                    if (kbdt) kbdt->finishRefill();
+                    kbdt = &refillSource(data_pkg, source_, duplicate);
+                }
+                is_initialized = true;
+
+                // the header is not unpacked again: its zone is handed over
+                kbdt->appendHeader(std::move(*it), header_zone_);
+                kbdt->setMetadata(header.obj, kbdt->lastFrame());
+                std::advance(it, 1);
+
+                // the data are decoded on the first access
+                auto layout = schema_.layout(source_, filter_);
+                kbdt->appendLazyData(std::move(*it), layout);
+                std::advance(it, 1);
+
+            } else if (isArray(header)) {
+                if (header.path.empty() || header.dtype.empty() || !header.has_shape)
+                    throw std::runtime_error(
+                        "Failed to parse the header: 'path', 'dtype' or 'shape' is not found!");
+
+                ++schema_misses_;
+                detail::SchemaCache::ArrayHeader array_header;
+                array_header.bytes.assign(header_data, header_size);
+                array_header.source = header.source.str();
+                array_header.path = header.path.str();
+                array_header.dtype = header.dtype.str();
+                toCppTypeString(array_header.dtype);
+                array_header.dtype_id = toDType(array_header.dtype);
+                array_header.shape.assign(header.shape.begin(), header.shape.begin() + header.ndim);
+
+                auto& added = schema_.addHeader(std::move(array_header));
+                if (!kbdt) kbdt = &refillSource(data_pkg, added.source, duplicate);
+                insertArray(*kbdt, added, it);
+            } else {
+                throw std::runtime_error("Unknown data content: " + header.content.str());
+            }
+        }
+        if (kbdt) kbdt->finishRefill();
+
+        // the sources which are not in this train
+        for (auto it_src = data_pkg.begin(); it_src != data_pkg.end();) {
+            if (it_src->second.isRecycled()) it_src = data_pkg.erase(it_src);
+            else ++it_src;
+        }
+    }
+
+    /*
+     * Decode the data of all the sources concurrently, which are otherwise
+     * decoded lazily.
+     */
+    void decodeParallel(std::map<std::string, kb_data>& data_pkg) {
+        auto& sources = lazy_sources_;
+        sources.clear();
+        for (auto& v : data_pkg) {
+            if (v.second.isLazy()) sources.push_back(&v.second);
+        }
+        parse_pool_->parallelFor(sources.size(), [&sources](std::size_t i) {
+            sources[i]->decode();
+        });
+    }
+
 public:
     /*
      * Constructor.
      *
      * @param timeout: connection timeout in second. "-1." (default) for infinite.
+     * @param prefetch: maximum number of "next" requests in flight. With the
+     *                  default value 1, the client waits for a reply before
+     *                  sending the next request. A larger value allows the
+     *                  server to send the following trains while the current
+     *                  one is being processed.
+     */
+    explicit Client(double timeout=-1., std::size_t prefetch=1)
+        : Client(toOptions(SocketType::REQ, timeout, prefetch)) {}
+
+    /*
+     * Constructor.
+     *
+     * @param type: messaging pattern of the server. No request is sent for
+     *              SocketType::PULL and SocketType::SUB.
+     * @param timeout: connection timeout in second. "-1." (default) for infinite.
+     * @param prefetch: maximum number of "next" requests in flight. Only used
+     *                  for SocketType::REQ.
+     */
+    explicit Client(SocketType type, double timeout=-1., std::size_t prefetch=1)
+        : Client(toOptions(type, timeout, prefetch)) {}
+
+    /*
+     * Constructor.
+     *
+     * @param options: see ClientOptions.
+     *
+     * Exceptions:
+     * zmq::error_t if an option is rejected by zmq
      */
-    explicit Client(double timeout=-1.): ctx_(1), socket_(ctx_, ZMQ_REQ) {
-      socket_.setsockopt(ZMQ_RCVTIMEO, timeout < 0 ? -1 : static_cast<int>(1000 * timeout));
-      socket_.setsockopt(ZMQ_LINGER, 0);
+    explicit Client(const ClientOptions& options)
+        : ctx_(options.context ? options.context
+                               : createContext(options.io_threads, options.io_thread_affinity)),
+          socket_(*ctx_, toZmqSocketType(options.type, options.prefetch)),
+          type_(options.type),
+          prefetch_(options.type != SocketType::REQ ? 0
+                                                    : (options.prefetch > 1 ? options.prefetch : 1)),
+          // a REQ socket cannot receive again before the next request is sent
+          latest_only_(options.latest_only && !(type_ == SocketType::REQ && prefetch_ <= 1)),
+          filter_(options.filter),
+          schema_(options.keys),
+          parse_pool_(options.parse_threads > 0 ? new detail::ThreadPool(options.parse_threads)
+                                                : nullptr),
+          parse_threshold_(options.parse_threshold) {
+      setSocketOptions(options);
     }
 
-    // The destructor of zmq::context_t calls 'zmq_ctx_destroy'.
+    // The destructor of zmq::context_t calls 'zmq_ctx_destroy' when the
+    // context is not shared by other clients.
     // The destructor of zmq::socket_t calls 'zmq_close'.
     ~Client() = default;
 
@@ -666,111 +2853,193 @@ public:
     Client& operator=(const Client&) = delete;
 
     void connect(const std::string& endpoint) {
+        // a SUB socket receives nothing without subscription
+        if (type_ == SocketType::SUB && !subscribed_) subscribe();
+
         std::cout << "Connecting to server: " << endpoint << std::endl;
         socket_.connect(endpoint);
     }
 
     /*
-     * Request and return the next data from the server.
+     * Subscribe to messages whose first frame starts with "topic". An empty
+     * topic (default) subscribes to all messages. Only for SocketType::SUB.
      *
      * Exceptions:
-     * std::runtime_error if unexpected message number or unknown "content" is found
+     * std::logic_error if the socket type is not SocketType::SUB
      */
-    std::map<std::string, kb_data> next() {
-        std::map<std::string, kb_data> data_pkg;
+    void subscribe(const std::string& topic="") {
+        if (type_ != SocketType::SUB)
+            throw std::logic_error("Only a SUB client can subscribe to a topic!");
+        socket_.setsockopt(ZMQ_SUBSCRIBE, topic.data(), topic.size());
+        subscribed_ = true;
+    }
 
-        if (!recv_ready_) {
-            sendRequest();
-            recv_ready_ = true;
-        }
+    SocketType socketType() const { return type_; }
 
-        MultipartMsg mpmsg;
-        try {
-            mpmsg = receiveMultipartMsg();
-            recv_ready_ = false;
-        } catch (const ZmqTimeoutError&) {
-            return data_pkg;
-        }
+    /*
+     * Only receive the selected sources and keys. A train without any
+     * selected data is returned as an empty map.
+     */
+    void setFilter(const SourceFilter& filter) {
+        filter_ = filter;
+        // the cached layouts were built with the previous filter
+        schema_.clear();
+    }
 
-        if (mpmsg.empty()) return data_pkg;
+    const SourceFilter& filter() const { return filter_; }
 
-        if (mpmsg.size() % 2)
-            throw std::runtime_error(
-                "The multipart message is expected to contain (header, data) pairs!");
+    /*
+     * Return the handle of a key (the path of array data or the key of
+     * other data), which can be used to access the data of every train:
+     *
+     *     auto image_key = client.key("image.data");
+     *     NDArray* image = data_pkg[source].findArray(image_key);
+     */
+    Key key(const std::string& name) { return schema_.keys()->intern(name); }
 
-        kb_data kbdt;
+    const std::shared_ptr<KeyTable>& keyTable() const { return schema_.keys(); }
 
-        std::string source;
-        bool is_initialized = false;
-        auto it = mpmsg.begin();
-        while(it != mpmsg.end()) {
-            // the header must contain "source" and "content"
-            msgpack::object_handle oh_header;
-            msgpack::unpack(oh_header, static_cast<const char*>(it->data()), it->size());
-            auto header_unpacked = oh_header.get().as<ObjectMap>();
+    // number of trains discarded in the latest-only mode
+    std::size_t skipped() const { return skipped_; }
+
+    /*
+     * Get the train ID of the last train received from the metadata of its
+     * sources which have been filtered out, e.g. when all of them were and
+     * the train was returned empty.
+     *
+     * Return false if it was not found.
+     */
+    bool filteredTrainId(uint64_t& tid) const {
+        if (has_filtered_tid_) tid = filtered_tid_;
+        return has_filtered_tid_;
+    }
 
-            auto content = header_unpacked.at("content").as<std::string>();
+    // Number of array headers and "msgpack" data whose structure was found
+    // in the schema cache. The "msgpack" data are only counted once they
+    // have been decoded.
+    std::size_t schemaHits() const { return schema_hits_ + schema_.layoutHits(); }
 
-            // the next message is the content (data)
-            if (content == "msgpack") {
-                if (!is_initialized)
-                    is_initialized = true;
-                else {
-                    data_pkg.insert(std::make_pair(source, std::move(kbdt)));
-                    // TODO: the following 'swap" seems to be redundant
-                    kb_data empty_data;
-                    kbdt.swap(empty_data);
-                }
+    // number of array headers and "msgpack" data which were fully parsed
+    std::size_t schemaMisses() const { return schema_misses_ + schema_.layoutMisses(); }
 
-                kbdt.appendMsg(std::move(*it));
-                std::advance(it, 1);
+    /*
+     * Request (SocketType::REQ only) and return the next data from the server.
+     *
+     * Exceptions:
+     * std::runtime_error if unexpected message number or unknown "content" is found
+     */
+    std::map<std::string, kb_data> next() {
+        requestNext();
+
+        if (!receiveTrain()) return std::map<std::string, kb_data>();
+        return decode(recv_msg_);
+    }
 
-                msgpack::object_handle oh_data;
-                msgpack::unpack(oh_data, static_cast<const char*>(it->data()), it->size());
-                kbdt.metadata = header_unpacked.at("metadata").as<ObjectMap>();
+    /*
+     * Request (SocketType::REQ only) and receive the next data into
+     * "data_pkg", which is refilled: the kb_data of the sources already in
+     * it are recycled and the other sources are erased.
+     *
+     * Passing the data of the previous train avoids most allocations. Once
+     * the structure of the trains is stable, i.e. the same sources, keys
+     * and array shapes, receiving a train does not allocate on the heap in
+     * the calling thread. The frames themselves are allocated by zmq.
+     *
+     * Return false if no data arrived before timeout, in which case
+     * "data_pkg" is left unchanged.
+     *
+     * Exceptions:
+     * std::runtime_error if unexpected message number or unknown "content"
+     * is found, in which case "data_pkg" is cleared
+     */
+    bool next(std::map<std::string, kb_data>& data_pkg) {
+        requestNext();
 
-                auto data_unpacked = oh_data.get().as<ObjectMap>();
-                for (auto& v : data_unpacked) kbdt.insert(v); // shallow copy
+        if (!receiveTrain()) return false;
+        decode(recv_msg_, data_pkg);
+        return true;
+    }
 
-                kbdt.appendHandle(std::move(oh_header));
-                kbdt.appendHandle(std::move(oh_data));
+    /*
+     * Return up to "n" trains in one call.
+     *
+     * All the "next" requests of the batch are sent at once if the client
+     * has prefetch (SocketType::REQ only). The trains are returned in the
+     * order of arrival. The latest-only mode does not apply.
+     *
+     * @param n: maximum number of trains.
+     * @param timeout: maximum time in second for the whole batch. Negative
+     *                 for infinite. The timeout of the client is not used.
+     *
+     * Return fewer than "n" trains on timeout.
+     *
+     * Exceptions:
+     * std::runtime_error if unexpected message number or unknown "content" is found
+     */
+    std::vector<std::map<std::string, kb_data>> next(std::size_t n, double timeout=-1.) {
+        using clock = std::chrono::steady_clock;
 
-            } else if ((content == "array" || content == "ImageData")) {
-                kbdt.appendMsg(std::move(*it));
-                std::advance(it, 1);
+        std::vector<std::map<std::string, kb_data>> data;
+        data.reserve(n);
 
-                auto tmp = header_unpacked.at("shape").as<std::vector<unsigned int>>();
-                std::vector<std::size_t> shape(tmp.begin(), tmp.end());
-                auto dtype = header_unpacked.at("dtype").as<std::string>();
-                toCppTypeString(dtype);
+        auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(timeout < 0 ? 0. : timeout));
+        while (data.size() < n) {
+            requestBatch(n - data.size());
 
-                kbdt.array.insert(std::make_pair(header_unpacked.at("path").as<std::string>(),
-                                                 NDArray(it->data(), shape, dtype)));
-            } else {
-                throw std::runtime_error("Unknown data content: " + content);
+            MultipartMsg mpmsg;
+            if (receiveMultipartMsg(mpmsg, ZMQ_DONTWAIT)) {
+                data.emplace_back(decode(mpmsg));
+                continue;
             }
 
-            source = header_unpacked.at("source").as<std::string>();
-
-            kbdt.appendMsg(std::move(*it));
-            std::advance(it, 1);
+            long wait = -1;
+            if (timeout >= 0) {
+                auto now = clock::now();
+                if (now >= deadline) break;
+                // round up to not wake up before the deadline
+                wait = static_cast<long>(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1);
+            }
+            if (!waitReadable(wait)) break;
         }
+        return data;
+    }
 
-        data_pkg.insert(std::make_pair(source, std::move(kbdt)));
-        kb_data empty_data;
-        kbdt.swap(empty_data);
+    /*
+     * Return the next data from the server only if it has already arrived.
+     *
+     * A "next" request is sent first if necessary (SocketType::REQ only).
+     * "data_pkg" is refilled as by next(data_pkg).
+     *
+     * Return false if no data is available.
+     *
+     * Exceptions:
+     * std::runtime_error if unexpected message number or unknown "content" is found
+     */
+    bool tryNext(std::map<std::string, kb_data>& data_pkg) {
+        requestNext();
 
-        return data_pkg;
+        if (!receiveTrain(ZMQ_DONTWAIT)) return false;
+        decode(recv_msg_, data_pkg);
+        return true;
     }
 
+    /*
+     * Return the underlying socket, e.g. to poll several clients in one thread.
+     */
+    zmq::socket_t& socket() { return socket_; }
+
+
     /*
      * Parse the next multipart message.
      *
      * Note:: this member function consumes data!!!
      */
     std::string showMsg() {
-        sendRequest();
-        auto mpmsg = receiveMultipartMsg();
+        requestNext();
+        MultipartMsg mpmsg;
+        if (!receiveMultipartMsg(mpmsg)) throw ZmqTimeoutError();
         return parseMultipartMsg(mpmsg);
     }
 
@@ -0,0 +1,536 @@
+/*
+    Karabo bridge conversion of array data.
+
+    Copyright (c) 2018, European X-Ray Free-Electron Laser Facility GmbH
+    All rights reserved.
+
+    You should have received a copy of the 3-Clause BSD License along with this
+    program. If not, see <https://opensource.org/licenses/BSD-3-Clause>
+
+    Author: Jun Zhu, zhujun981661@gmail.com
+*/
+
+#ifndef KARABO_BRIDGE_KB_CONVERT_HPP
+#define KARABO_BRIDGE_KB_CONVERT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+
+#include "kb_thread_pool.hpp"
+
+// SIMD kernels are compiled for x86 with GCC or clang and selected at
+// runtime. Define KARABO_BRIDGE_NO_SIMD to use the portable loops only.
+#if !defined(KARABO_BRIDGE_NO_SIMD) && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define KARABO_BRIDGE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define KARABO_BRIDGE_X86_SIMD 0
+#endif
+
+
+namespace karabo_bridge {
+
+/*
+ * Tag to request the conversion of the data of an NDArray to another
+ * element type, e.g.
+ *
+ *     auto vec = array.as<std::vector<float>>(karabo_bridge::convert);
+ */
+struct convert_t {};
+constexpr convert_t convert = convert_t();
+
+namespace detail {
+
+// Arrays with at least this number of bytes are converted in parallel.
+constexpr std::size_t PARALLEL_CONVERT_THRESHOLD = 1 << 22;
+
+// Copies of at least this number of bytes, which exceeds the last level
+// cache of most machines, use non-temporal stores.
+constexpr std::size_t STREAMING_COPY_THRESHOLD = 1 << 24;
+
+// elements per chunk of a parallel conversion are a multiple of it
+constexpr std::size_t CONVERT_CHUNK_ALIGNMENT = 64;
+
+// bytes per chunk of a parallel copy are a multiple of it
+constexpr std::size_t COPY_CHUNK_ALIGNMENT = 4096;
+
+enum class SimdLevel : uint8_t { NONE, SSE41, AVX2, AVX512 };
+
+/*
+ * Return the widest instruction set supported by the CPU, which is
+ * detected once.
+ */
+inline SimdLevel simdLevel() {
+#if KARABO_BRIDGE_X86_SIMD
+    static const SimdLevel level = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+        if (__builtin_cpu_supports("sse4.1")) return SimdLevel::SSE41;
+        return SimdLevel::NONE;
+    }();
+    return level;
+#else
+    return SimdLevel::NONE;
+#endif
+}
+
+/*
+ * Element-wise static_cast, which is the fallback of all the kernels.
+ */
+template<typename Src, typename Dst>
+inline void convertLoop(const Src* src, Dst* dst, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) dst[i] = static_cast<Dst>(src[i]);
+}
+
+#if KARABO_BRIDGE_X86_SIMD
+
+/*
+ * SIMD kernels of the conversions of detector data. Each of them converts
+ * the leading whole vectors and returns the number of converted elements.
+ */
+namespace simd {
+
+#define KB_SSE2 __attribute__((target("sse2")))
+#define KB_SSE41 __attribute__((target("sse4.1")))
+#define KB_AVX2 __attribute__((target("avx2")))
+#define KB_AVX512 __attribute__((target("avx512f")))
+
+// SSE4.1
+
+KB_SSE41 inline std::size_t toFloatSse41(const uint8_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        int32_t chunk;
+        std::memcpy(&chunk, src + i, 4);
+        __m128i v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(chunk));
+        _mm_storeu_ps(dst + i, _mm_cvtepi32_ps(v));
+    }
+    return i;
+}
+
+KB_SSE41 inline std::size_t toFloatSse41(const int8_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        int32_t chunk;
+        std::memcpy(&chunk, src + i, 4);
+        __m128i v = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(chunk));
+        _mm_storeu_ps(dst + i, _mm_cvtepi32_ps(v));
+    }
+    return i;
+}
+
+KB_SSE41 inline std::size_t toFloatSse41(const uint16_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_ps(dst + i, _mm_cvtepi32_ps(_mm_cvtepu16_epi32(v)));
+        _mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(v, 8))));
+    }
+    return i;
+}
+
+KB_SSE41 inline std::size_t toFloatSse41(const int16_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_ps(dst + i, _mm_cvtepi32_ps(_mm_cvtepi16_epi32(v)));
+        _mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(v, 8))));
+    }
+    return i;
+}
+
+KB_SSE41 inline std::size_t toFloatSse41(const int32_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_ps(dst + i, _mm_cvtepi32_ps(v));
+    }
+    return i;
+}
+
+KB_SSE41 inline std::size_t toDoubleSse41(const float* src, double* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        _mm_storeu_pd(dst + i, _mm_cvtps_pd(v));
+        _mm_storeu_pd(dst + i + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+    return i;
+}
+
+KB_SSE41 inline std::size_t toFloatSse41(const double* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 2));
+        _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+    }
+    return i;
+}
+
+// AVX2
+
+KB_AVX2 inline std::size_t toFloatAvx2(const uint8_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)));
+    }
+    return i;
+}
+
+KB_AVX2 inline std::size_t toFloatAvx2(const int8_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(v)));
+    }
+    return i;
+}
+
+KB_AVX2 inline std::size_t toFloatAvx2(const uint16_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v)));
+    }
+    return i;
+}
+
+KB_AVX2 inline std::size_t toFloatAvx2(const int16_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)));
+    }
+    return i;
+}
+
+KB_AVX2 inline std::size_t toFloatAvx2(const int32_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(v));
+    }
+    return i;
+}
+
+KB_AVX2 inline std::size_t toDoubleAvx2(const float* src, double* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+        _mm256_storeu_pd(dst + i, _mm256_cvtps_pd(_mm_loadu_ps(src + i)));
+    return i;
+}
+
+KB_AVX2 inline std::size_t toFloatAvx2(const double* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+        _mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_loadu_pd(src + i)));
+    return i;
+}
+
+// AVX-512F
+//
+// The AVX-512 intrinsics of GCC 12 trigger false -Wmaybe-uninitialized
+// warnings (GCC bug 105593).
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+KB_AVX512 inline std::size_t toFloatAvx512(const uint8_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm512_storeu_ps(dst + i, _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(v)));
+    }
+    return i;
+}
+
+KB_AVX512 inline std::size_t toFloatAvx512(const int8_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm512_storeu_ps(dst + i, _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(v)));
+    }
+    return i;
+}
+
+KB_AVX512 inline std::size_t toFloatAvx512(const uint16_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm512_storeu_ps(dst + i, _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(v)));
+    }
+    return i;
+}
+
+KB_AVX512 inline std::size_t toFloatAvx512(const int16_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm512_storeu_ps(dst + i, _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(v)));
+    }
+    return i;
+}
+
+KB_AVX512 inline std::size_t toFloatAvx512(const int32_t* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m512i v = _mm512_loadu_si512(src + i);
+        _mm512_storeu_ps(dst + i, _mm512_cvtepi32_ps(v));
+    }
+    return i;
+}
+
+KB_AVX512 inline std::size_t toDoubleAvx512(const float* src, double* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+        _mm512_storeu_pd(dst + i, _mm512_cvtps_pd(_mm256_loadu_ps(src + i)));
+    return i;
+}
+
+KB_AVX512 inline std::size_t toFloatAvx512(const double* src, float* dst, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+        _mm256_storeu_ps(dst + i, _mm512_cvtpd_ps(_mm512_loadu_pd(src + i)));
+    return i;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Streaming copies with non-temporal stores, which bypass the cache. The
+// copy is bound by the memory bandwidth, so wider vectors do not help, but
+// copying 4 pages at once, as glibc does, reduces the DRAM page misses.
+
+constexpr std::size_t STREAM_PAGE_SIZE = 4096;
+constexpr std::size_t STREAM_PAGES = 4;
+
+KB_SSE2 inline void streamCopySse2(const char* src, char* dst, std::size_t size) {
+    // the stores must be aligned, the loads need not
+    std::size_t i = (STREAM_PAGE_SIZE - reinterpret_cast<std::uintptr_t>(dst) % STREAM_PAGE_SIZE)
+                    % STREAM_PAGE_SIZE;
+    if (i > size) i = size;
+    std::memcpy(dst, src, i);
+    for (; i + STREAM_PAGES * STREAM_PAGE_SIZE <= size; i += STREAM_PAGES * STREAM_PAGE_SIZE) {
+        for (std::size_t j = i; j < i + STREAM_PAGE_SIZE; j += 32) {
+            for (std::size_t k = j; k < j + STREAM_PAGES * STREAM_PAGE_SIZE; k += STREAM_PAGE_SIZE) {
+                __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + k));
+                __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + k + 16));
+                _mm_stream_si128(reinterpret_cast<__m128i*>(dst + k), v0);
+                _mm_stream_si128(reinterpret_cast<__m128i*>(dst + k + 16), v1);
+            }
+        }
+    }
+    for (; i + 16 <= size; i += 16)
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+    std::memcpy(dst + i, src + i, size - i);
+    _mm_sfence();
+}
+
+KB_AVX2 inline void streamCopyAvx2(const char* src, char* dst, std::size_t size) {
+    std::size_t i = (STREAM_PAGE_SIZE - reinterpret_cast<std::uintptr_t>(dst) % STREAM_PAGE_SIZE)
+                    % STREAM_PAGE_SIZE;
+    if (i > size) i = size;
+    std::memcpy(dst, src, i);
+    for (; i + STREAM_PAGES * STREAM_PAGE_SIZE <= size; i += STREAM_PAGES * STREAM_PAGE_SIZE) {
+        for (std::size_t j = i; j < i + STREAM_PAGE_SIZE; j += 64) {
+            for (std::size_t k = j; k < j + STREAM_PAGES * STREAM_PAGE_SIZE; k += STREAM_PAGE_SIZE) {
+                __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + k));
+                __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + k + 32));
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + k), v0);
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + k + 32), v1);
+            }
+        }
+    }
+    for (; i + 32 <= size; i += 32)
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+    std::memcpy(dst + i, src + i, size - i);
+    _mm_sfence();
+}
+
+#undef KB_SSE2
+#undef KB_SSE41
+#undef KB_AVX2
+#undef KB_AVX512
+
+} // simd
+
+#endif // KARABO_BRIDGE_X86_SIMD
+
+/*
+ * Convert a contiguous range on the calling thread. The pairs without a
+ * SIMD kernel use the portable loop, which the compiler may vectorize
+ * itself at -O3.
+ */
+template<typename Src, typename Dst, typename Enable=void>
+struct convert_kernel {
+    void operator()(const Src* src, Dst* dst, std::size_t size) const {
+        convertLoop(src, dst, size);
+    }
+};
+
+/*
+ * Copy a contiguous range of bytes on the calling thread.
+ *
+ * @param streaming: bypass the cache of the destination, which will not
+ *                   be read soon.
+ */
+inline void copyBytes(const char* src, char* dst, std::size_t size, bool streaming) {
+#if KARABO_BRIDGE_X86_SIMD
+    if (streaming && simdLevel() >= SimdLevel::AVX2) return simd::streamCopyAvx2(src, dst, size);
+    if (streaming && simdLevel() >= SimdLevel::SSE41) return simd::streamCopySse2(src, dst, size);
+#else
+    (void)streaming;
+#endif
+    if (size) std::memcpy(dst, src, size);
+}
+
+template<typename T>
+struct convert_kernel<T, T> {
+    void operator()(const T* src, T* dst, std::size_t size) const {
+        copyBytes(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                  size * sizeof(T), false);
+    }
+};
+
+#if KARABO_BRIDGE_X86_SIMD
+
+template<typename Src>
+struct convert_kernel<Src, float,
+                      typename std::enable_if<std::is_same<Src, uint8_t>::value ||
+                                              std::is_same<Src, int8_t>::value ||
+                                              std::is_same<Src, uint16_t>::value ||
+                                              std::is_same<Src, int16_t>::value ||
+                                              std::is_same<Src, int32_t>::value ||
+                                              std::is_same<Src, double>::value>::type> {
+    void operator()(const Src* src, float* dst, std::size_t size) const {
+        std::size_t done;
+        switch (simdLevel()) {
+            case SimdLevel::AVX512: done = simd::toFloatAvx512(src, dst, size); break;
+            case SimdLevel::AVX2: done = simd::toFloatAvx2(src, dst, size); break;
+            case SimdLevel::SSE41: done = simd::toFloatSse41(src, dst, size); break;
+            default: done = 0;
+        }
+        convertLoop(src + done, dst + done, size - done);
+    }
+};
+
+template<>
+struct convert_kernel<float, double> {
+    void operator()(const float* src, double* dst, std::size_t size) const {
+        std::size_t done;
+        switch (simdLevel()) {
+            case SimdLevel::AVX512: done = simd::toDoubleAvx512(src, dst, size); break;
+            case SimdLevel::AVX2: done = simd::toDoubleAvx2(src, dst, size); break;
+            case SimdLevel::SSE41: done = simd::toDoubleSse41(src, dst, size); break;
+            default: done = 0;
+        }
+        convertLoop(src + done, dst + done, size - done);
+    }
+};
+
+#endif // KARABO_BRIDGE_X86_SIMD
+
+} // detail
+
+namespace detail {
+
+/*
+ * Run f(first, count) for the chunks of [0, size), which are a multiple
+ * of "alignment" except the last one, on the threads of sharedPool().
+ * f(0, size) is run on the calling thread instead if the pool is busy.
+ */
+template<typename F>
+void forEachChunk(std::size_t size, std::size_t alignment, const F& f) {
+    auto& pool = sharedPool();
+    std::size_t n_chunks = pool.size() + 1;
+    std::size_t chunk = (size + n_chunks - 1) / n_chunks;
+    chunk = (chunk + alignment - 1) / alignment * alignment;
+    bool done = pool.tryParallelFor(n_chunks, [=, &f](std::size_t i) {
+        std::size_t first = i * chunk;
+        if (first >= size) return;
+        f(first, first + chunk < size ? chunk : size - first);
+    });
+    if (!done) f(0, size);
+}
+
+/*
+ * Write to every page of [ptr, ptr + size) on the threads of sharedPool(),
+ * so that they, and not the calling thread, take the page faults of newly
+ * allocated memory.
+ */
+inline void touchPages(char* ptr, std::size_t size) {
+    if (!size) return;
+    forEachChunk(size, COPY_CHUNK_ALIGNMENT, [=](std::size_t first, std::size_t count) {
+        for (std::size_t i = first; i < first + count; i += COPY_CHUNK_ALIGNMENT) ptr[i] = 0;
+        ptr[first + count - 1] = 0;
+    });
+}
+
+} // detail
+
+/*
+ * Convert "size" elements from "src" to "dst" as static_cast does, e.g.
+ * raw uint16_t detector data to float. Conversions from a floating point
+ * value which is out of the range of an integer type are undefined.
+ *
+ * The most common conversions of detector data (8, 16 and 32 bit
+ * integers to float, float <-> double) use SSE4.1, AVX2 or AVX-512,
+ * whichever the CPU supports.
+ *
+ * @param parallel: split a large array (see PARALLEL_CONVERT_THRESHOLD)
+ *                  across the threads of detail::sharedPool().
+ */
+template<typename Src, typename Dst>
+void convertArray(const Src* src, Dst* dst, std::size_t size, bool parallel=true) {
+    detail::convert_kernel<Src, Dst> kernel;
+
+    std::size_t bytes = size * (sizeof(Src) > sizeof(Dst) ? sizeof(Src) : sizeof(Dst));
+    if (parallel && bytes >= detail::PARALLEL_CONVERT_THRESHOLD) {
+        detail::forEachChunk(size, detail::CONVERT_CHUNK_ALIGNMENT,
+            [=, &kernel](std::size_t first, std::size_t count) {
+                kernel(src + first, dst + first, count);
+            });
+        return;
+    }
+
+    kernel(src, dst, size);
+}
+
+/*
+ * Copy "size" elements from "src" to "dst".
+ *
+ * A large array (see PARALLEL_CONVERT_THRESHOLD) is copied in parallel.
+ * Above STREAMING_COPY_THRESHOLD, the destination is written with
+ * non-temporal stores, so that a copy which is processed much later does
+ * not evict the data being processed from the cache.
+ */
+template<typename T>
+void convertArray(const T* src, T* dst, std::size_t size, bool parallel=true) {
+    auto src_bytes = reinterpret_cast<const char*>(src);
+    auto dst_bytes = reinterpret_cast<char*>(dst);
+    std::size_t bytes = size * sizeof(T);
+    bool streaming = bytes >= detail::STREAMING_COPY_THRESHOLD;
+    if (parallel && bytes >= detail::PARALLEL_CONVERT_THRESHOLD) {
+        detail::forEachChunk(bytes, detail::COPY_CHUNK_ALIGNMENT,
+            [=](std::size_t first, std::size_t count) {
+                detail::copyBytes(src_bytes + first, dst_bytes + first, count, streaming);
+            });
+        return;
+    }
+
+    detail::copyBytes(src_bytes, dst_bytes, bytes, streaming);
+}
+
+} // karabo_bridge
+
+#endif //KARABO_BRIDGE_KB_CONVERT_HPP
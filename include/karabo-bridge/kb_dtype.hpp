@@ -0,0 +1,120 @@
+/*
+    Karabo bridge data types.
+
+    Copyright (c) 2018, European X-Ray Free-Electron Laser Facility GmbH
+    All rights reserved.
+
+    You should have received a copy of the 3-Clause BSD License along with this
+    program. If not, see <https://opensource.org/licenses/BSD-3-Clause>
+
+    Author: Jun Zhu, zhujun981661@gmail.com
+*/
+
+#ifndef KARABO_BRIDGE_KB_DTYPE_HPP
+#define KARABO_BRIDGE_KB_DTYPE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+
+namespace karabo_bridge {
+
+/*
+ * Data type of an NDArray, or of a MsgpackObject (of its elements for an
+ * array), which is parsed once when the data are received.
+ *
+ * The types after DOUBLE only describe msgpack data.
+ */
+enum class DType : uint8_t {
+    UNKNOWN,
+    BOOL,
+    INT8, INT16, INT32, INT64,
+    UINT8, UINT16, UINT32, UINT64,
+    FLOAT, DOUBLE,
+    CHAR, // binary data
+    STRING,
+    NIL,
+    ARRAY,
+    MAP,
+    BIN,
+    EXT,
+    UNDEFINED // elements of a map
+};
+
+/*
+ * Return the name of a data type, which is returned by Object::dtype().
+ */
+inline const std::string& dtypeName(DType dtype) {
+    static const std::string names[] {
+        "unknown",
+        "bool",
+        "int8_t", "int16_t", "int32_t", "int64_t",
+        "uint8_t", "uint16_t", "uint32_t", "uint64_t",
+        "float", "double",
+        "char",
+        "string",
+        "MSGPACK_OBJECT_NIL",
+        "MSGPACK_OBJECT_ARRAY",
+        "MSGPACK_OBJECT_MAP",
+        "MSGPACK_OBJECT_BIN",
+        "MSGPACK_OBJECT_EXT",
+        "undefined"
+    };
+    return names[static_cast<std::size_t>(dtype)];
+}
+
+/*
+ * Return the numeric data type of a C++ type name, e.g. "uint16_t", or
+ * DType::UNKNOWN.
+ */
+inline DType toDType(const char* name, std::size_t size) {
+    for (auto dtype = static_cast<std::size_t>(DType::BOOL);
+         dtype <= static_cast<std::size_t>(DType::DOUBLE); ++dtype) {
+        auto& expected = dtypeName(static_cast<DType>(dtype));
+        if (expected.size() == size && std::memcmp(expected.data(), name, size) == 0)
+            return static_cast<DType>(dtype);
+    }
+    return DType::UNKNOWN;
+}
+
+inline DType toDType(const std::string& name) { return toDType(name.data(), name.size()); }
+
+// size in bytes of an element of a numeric data type, 0 for the others
+inline std::size_t itemSize(DType dtype) {
+    switch (dtype) {
+        case DType::BOOL:
+        case DType::INT8:
+        case DType::UINT8: return 1;
+        case DType::INT16:
+        case DType::UINT16: return 2;
+        case DType::INT32:
+        case DType::UINT32:
+        case DType::FLOAT: return 4;
+        case DType::INT64:
+        case DType::UINT64:
+        case DType::DOUBLE: return 8;
+        default: return 0;
+    }
+}
+
+/*
+ * Numeric data type of a C++ type, DType::UNKNOWN for the others.
+ */
+template<typename T> struct dtype_of { static constexpr DType value = DType::UNKNOWN; };
+
+template<> struct dtype_of<bool> { static constexpr DType value = DType::BOOL; };
+template<> struct dtype_of<int8_t> { static constexpr DType value = DType::INT8; };
+template<> struct dtype_of<int16_t> { static constexpr DType value = DType::INT16; };
+template<> struct dtype_of<int32_t> { static constexpr DType value = DType::INT32; };
+template<> struct dtype_of<int64_t> { static constexpr DType value = DType::INT64; };
+template<> struct dtype_of<uint8_t> { static constexpr DType value = DType::UINT8; };
+template<> struct dtype_of<uint16_t> { static constexpr DType value = DType::UINT16; };
+template<> struct dtype_of<uint32_t> { static constexpr DType value = DType::UINT32; };
+template<> struct dtype_of<uint64_t> { static constexpr DType value = DType::UINT64; };
+template<> struct dtype_of<float> { static constexpr DType value = DType::FLOAT; };
+template<> struct dtype_of<double> { static constexpr DType value = DType::DOUBLE; };
+
+} // karabo_bridge
+
+#endif //KARABO_BRIDGE_KB_DTYPE_HPP
@@ -0,0 +1,120 @@
+/*
+    Karabo bridge source filter.
+
+    Copyright (c) 2018, European X-Ray Free-Electron Laser Facility GmbH
+    All rights reserved.
+
+    You should have received a copy of the 3-Clause BSD License along with this
+    program. If not, see <https://opensource.org/licenses/BSD-3-Clause>
+
+    Author: Jun Zhu, zhujun981661@gmail.com
+*/
+
+#ifndef KARABO_BRIDGE_KB_FILTER_HPP
+#define KARABO_BRIDGE_KB_FILTER_HPP
+
+#include <string>
+#include <vector>
+
+
+namespace karabo_bridge {
+
+/*
+ * Selection of the sources, and optionally of their keys, to be received.
+ *
+ * Sources and keys are selected by exact names or by glob patterns, in
+ * which '*' matches any sequence of characters and '?' matches a single
+ * character, e.g. "*CH0:xtdf". An empty filter selects everything.
+ */
+class SourceFilter {
+
+    struct Rule {
+        std::string pattern;
+        std::vector<std::string> keys; // empty for all the keys
+    };
+
+    std::vector<Rule> rules_;
+
+    static bool match(const std::string& pattern, const char* s, std::size_t size) {
+        std::size_t p = 0;
+        std::size_t i = 0;
+        // position of the last '*' and of the string when it was met
+        std::size_t star = std::string::npos;
+        std::size_t star_i = 0;
+        while (i < size) {
+            if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == s[i])) {
+                ++p;
+                ++i;
+            } else if (p < pattern.size() && pattern[p] == '*') {
+                star = p++;
+                star_i = i;
+            } else if (star != std::string::npos) {
+                // let the last '*' match one more character
+                p = star + 1;
+                i = ++star_i;
+            } else {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == '*') ++p;
+        return p == pattern.size();
+    }
+
+public:
+    /*
+     * Select the sources matching "pattern".
+     *
+     * @param pattern: source name or glob pattern.
+     * @param keys: names or glob patterns of the keys (the paths of the
+     *              array data and the keys of the other data) to be
+     *              selected. Empty (default) for all the keys.
+     */
+    SourceFilter& add(const std::string& pattern, const std::vector<std::string>& keys={}) {
+        rules_.push_back({pattern, keys});
+        return *this;
+    }
+
+    bool empty() const { return rules_.empty(); }
+
+    bool selectsSource(const char* source, std::size_t size) const {
+        if (rules_.empty()) return true;
+        for (auto& rule : rules_) {
+            if (match(rule.pattern, source, size)) return true;
+        }
+        return false;
+    }
+
+    bool selectsSource(const std::string& source) const {
+        return selectsSource(source.data(), source.size());
+    }
+
+    bool selectsKey(const char* source, std::size_t source_size,
+                    const char* key, std::size_t key_size) const {
+        if (rules_.empty()) return true;
+        for (auto& rule : rules_) {
+            if (!match(rule.pattern, source, source_size)) continue;
+            if (rule.keys.empty()) return true;
+            for (auto& pattern : rule.keys) {
+                if (match(pattern, key, key_size)) return true;
+            }
+        }
+        return false;
+    }
+
+    bool selectsKey(const std::string& source, const std::string& key) const {
+        return selectsKey(source.data(), source.size(), key.data(), key.size());
+    }
+
+    // Return true if the source is selected without any key list.
+    bool selectsAllKeys(const std::string& source) const {
+        if (rules_.empty()) return true;
+        for (auto& rule : rules_) {
+            if (rule.keys.empty() && match(rule.pattern, source.data(), source.size())) return true;
+        }
+        return false;
+    }
+};
+
+} // karabo_bridge
+
+#endif //KARABO_BRIDGE_KB_FILTER_HPP
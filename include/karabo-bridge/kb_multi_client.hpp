@@ -0,0 +1,296 @@
+/*
+    Karabo bridge client for multiple endpoints.
+
+    Copyright (c) 2018, European X-Ray Free-Electron Laser Facility GmbH
+    All rights reserved.
+
+    You should have received a copy of the 3-Clause BSD License along with this
+    program. If not, see <https://opensource.org/licenses/BSD-3-Clause>
+
+    Author: Jun Zhu, zhujun981661@gmail.com
+*/
+
+#ifndef KARABO_BRIDGE_KB_MULTI_CLIENT_HPP
+#define KARABO_BRIDGE_KB_MULTI_CLIENT_HPP
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "kb_client.hpp"
+
+
+namespace karabo_bridge {
+
+/*
+ * Karabo-bridge client which receives data from several endpoints, e.g. one
+ * endpoint per detector module, and merges them by train ID.
+ *
+ * All the endpoints are polled in the caller's thread. Data which belong to
+ * the same train ("timestamp.tid") are collected in a bounded reorder window.
+ * A train is returned once all the endpoints have delivered it, or as a
+ * partial train after "partial_timeout" or when the window overflows.
+ * Trains are always returned in ascending order of train ID.
+ */
+class MultiClient {
+
+public:
+    using TrainData = std::map<std::string, kb_data>;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct PendingTrain {
+        TrainData data;
+        std::vector<bool> received; // per endpoint
+        std::size_t n_received = 0;
+        clock::time_point first_seen;
+    };
+
+    std::vector<std::unique_ptr<Client>> clients_;
+    // options shared by all the clients, including the zmq context and the key table
+    ClientOptions options_;
+
+    double partial_timeout_;
+    std::size_t window_;
+
+    // trains waiting to be completed, ordered by train ID
+    std::map<uint64_t, PendingTrain> pending_;
+
+    bool has_emitted_ = false;
+    uint64_t last_emitted_tid_ = 0;
+
+    std::size_t n_complete_ = 0;
+    std::size_t n_partial_ = 0;
+    std::size_t n_late_ = 0;
+    std::size_t n_missing_ = 0;
+
+    static uint64_t trainId(const TrainData& data) {
+        for (auto& src : data) {
+            auto it = src.second.metadata.find("timestamp.tid");
+            if (it != src.second.metadata.end()) return it->second.as<uint64_t>();
+        }
+        throw std::runtime_error("Train ID (timestamp.tid) not found in the received data!");
+    }
+
+    /*
+     * Put the data received from an endpoint into the reorder window.
+     */
+    void collect(std::size_t idx, TrainData& data) {
+        uint64_t tid;
+        if (!data.empty()) tid = trainId(data);
+        // All the sources of the train may have been filtered out, in which
+        // case the endpoint has still delivered it.
+        else if (!clients_[idx]->filteredTrainId(tid)) return;
+
+        if (has_emitted_ && tid <= last_emitted_tid_) {
+            // the train has already been returned
+            ++n_late_;
+            return;
+        }
+
+        auto it = pending_.find(tid);
+        if (it == pending_.end()) {
+            it = pending_.emplace(tid, PendingTrain()).first;
+            it->second.received.assign(clients_.size(), false);
+            it->second.first_seen = clock::now();
+        }
+
+        auto& train = it->second;
+        for (auto& src : data) train.data.insert(std::make_pair(src.first, std::move(src.second)));
+        if (!train.received[idx]) {
+            train.received[idx] = true;
+            ++train.n_received;
+        }
+    }
+
+    /*
+     * Move the oldest train in the window into "data" if it is complete,
+     * expired or pushed out of the window.
+     */
+    bool popReady(TrainData& data) {
+        if (pending_.empty()) return false;
+
+        auto it = pending_.begin();
+        auto& train = it->second;
+        bool complete = train.n_received == clients_.size();
+        if (!complete
+                && pending_.size() <= window_
+                && clock::now() - train.first_seen < toDuration(partial_timeout_))
+            return false;
+
+        if (complete) ++n_complete_;
+        else {
+            ++n_partial_;
+            n_missing_ += clients_.size() - train.n_received;
+        }
+
+        data = std::move(train.data);
+        has_emitted_ = true;
+        last_emitted_tid_ = it->first;
+        pending_.erase(it);
+        return true;
+    }
+
+    /*
+     * Collect all the data which are already available. It also sends the
+     * "next" requests if necessary.
+     */
+    void collectAvailable() {
+        for (std::size_t i = 0; i < clients_.size(); ++i) {
+            TrainData data;
+            while (clients_[i]->tryNext(data)) collect(i, data);
+        }
+    }
+
+    /*
+     * Wait until any endpoint becomes readable and collect its data.
+     *
+     * @param timeout: timeout in millisecond, -1 for infinite.
+     */
+    void poll(long timeout) {
+        std::vector<zmq::pollitem_t> items;
+        items.reserve(clients_.size());
+        for (auto& client : clients_)
+            items.push_back({static_cast<void*>(client->socket()), 0, ZMQ_POLLIN, 0});
+
+        zmq::poll(items.data(), items.size(), timeout);
+
+        for (std::size_t i = 0; i < items.size(); ++i) {
+            if (!(items[i].revents & ZMQ_POLLIN)) continue;
+            TrainData data;
+            while (clients_[i]->tryNext(data)) collect(i, data);
+        }
+    }
+
+    static ClientOptions toOptions(SocketType type, double timeout, std::size_t prefetch) {
+        ClientOptions options;
+        options.type = type;
+        options.timeout = timeout;
+        options.prefetch = prefetch;
+        return options;
+    }
+
+    static clock::duration toDuration(double seconds) {
+        return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+    }
+
+    static long toMilliseconds(clock::duration duration) {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+        return ms > 0 ? static_cast<long>(ms) : 0;
+    }
+
+public:
+    /*
+     * Constructor.
+     *
+     * @param timeout: timeout of next() in second. "-1." (default) for infinite.
+     * @param partial_timeout: time in second after the first data of a train
+     *                         arrived before the train is returned even if
+     *                         some endpoints are missing.
+     * @param window: maximum number of incomplete trains kept in the reorder window.
+     * @param type: messaging pattern of the servers.
+     * @param prefetch: maximum number of "next" requests in flight per endpoint.
+     */
+    explicit MultiClient(double timeout=-1.,
+                         double partial_timeout=1.,
+                         std::size_t window=4,
+                         SocketType type=SocketType::REQ,
+                         std::size_t prefetch=1)
+        : MultiClient(toOptions(type, timeout, prefetch), partial_timeout, window) {}
+
+    /*
+     * Constructor.
+     *
+     * @param options: options of the clients. "timeout" is the timeout of
+     *                 next(). All the clients share one zmq context and one
+     *                 key table, which are created if not given.
+     * @param partial_timeout: see above.
+     * @param window: see above.
+     */
+    explicit MultiClient(const ClientOptions& options,
+                         double partial_timeout=1.,
+                         std::size_t window=4)
+        : options_(options),
+          partial_timeout_(partial_timeout),
+          window_(window > 0 ? window : 1) {
+        if (!options_.context)
+            options_.context = createContext(options_.io_threads, options_.io_thread_affinity);
+        if (!options_.keys) options_.keys = std::make_shared<KeyTable>();
+    }
+
+    ~MultiClient() = default;
+
+    MultiClient(const MultiClient&) = delete;
+    MultiClient& operator=(const MultiClient&) = delete;
+
+    /*
+     * Add an endpoint, e.g. one detector module.
+     */
+    void connect(const std::string& endpoint) {
+        if (!pending_.empty())
+            throw std::logic_error("Endpoints cannot be added while trains are pending!");
+        ClientOptions options(options_);
+        options.timeout = 0; // the sockets are polled
+        clients_.emplace_back(new Client(options));
+        clients_.back()->connect(endpoint);
+    }
+
+    /*
+     * Return the next (complete or partial) train merged from all the endpoints.
+     *
+     * An empty map is returned on timeout.
+     *
+     * Exceptions:
+     * std::runtime_error if the received data does not contain "timestamp.tid"
+     */
+    TrainData next() {
+        TrainData data;
+        if (clients_.empty()) return data;
+
+        auto start = clock::now();
+        while (true) {
+            collectAvailable();
+            if (popReady(data)) return data;
+
+            auto now = clock::now();
+            long wait = -1;
+            if (options_.timeout >= 0) {
+                auto deadline = start + toDuration(options_.timeout);
+                if (now >= deadline) return data;
+                wait = toMilliseconds(deadline - now);
+            }
+            if (!pending_.empty()) {
+                auto expiry = pending_.begin()->second.first_seen + toDuration(partial_timeout_);
+                auto wait_partial = toMilliseconds(expiry - now);
+                if (wait < 0 || wait_partial < wait) wait = wait_partial;
+            }
+
+            poll(wait);
+        }
+    }
+
+    // Return the handle of a key, which is valid for the data of all the endpoints.
+    Key key(const std::string& name) { return options_.keys->intern(name); }
+
+    std::size_t size() const { return clients_.size(); }
+
+    // number of incomplete trains in the reorder window
+    std::size_t pending() const { return pending_.size(); }
+
+    // number of trains returned with data from all the endpoints
+    std::size_t completeTrains() const { return n_complete_; }
+
+    // number of trains returned with data missing from some endpoints
+    std::size_t partialTrains() const { return n_partial_; }
+
+    // number of data discarded because their train had already been returned
+    std::size_t lateData() const { return n_late_; }
+
+    // total number of endpoint data missing in the partial trains
+    std::size_t missingData() const { return n_missing_; }
+};
+
+} // karabo_bridge
+
+#endif //KARABO_BRIDGE_KB_MULTI_CLIENT_HPP
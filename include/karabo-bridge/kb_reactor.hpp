@@ -0,0 +1,412 @@
+/*
+    Karabo bridge reactor.
+
+    Copyright (c) 2018, European X-Ray Free-Electron Laser Facility GmbH
+    All rights reserved.
+
+    You should have received a copy of the 3-Clause BSD License along with this
+    program. If not, see <https://opensource.org/licenses/BSD-3-Clause>
+
+    Author: Jun Zhu, zhujun981661@gmail.com
+*/
+
+#ifndef KARABO_BRIDGE_KB_REACTOR_HPP
+#define KARABO_BRIDGE_KB_REACTOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "kb_client.hpp"
+
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define KARABO_BRIDGE_HAS_COROUTINE 1
+#endif
+#endif
+
+
+namespace karabo_bridge {
+
+/*
+ * Event loop which services many clients in one thread.
+ *
+ * Each registered client is polled with zmq::poll and the parsed data are
+ * passed to the callback of the client. It is meant for a large number of
+ * low-rate sources, while high-rate clients are better served by dedicated
+ * threads.
+ *
+ * The reactor also drives the asynchronous API nextAsync() (and awaitNext()
+ * in C++20), which does not need a thread per client.
+ */
+class Reactor {
+
+public:
+    using TrainData = std::map<std::string, kb_data>;
+    using Callback = std::function<void(TrainData&)>;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Client* client;
+        Callback callback;
+        // A one-shot entry is removed after the first data or at the deadline.
+        bool once;
+        std::function<void()> on_timeout;
+        clock::time_point deadline;
+    };
+
+    // used to wake up the reactor thread when the registration changes
+    zmq::context_t ctx_;
+    zmq::socket_t wake_recv_;
+    zmq::socket_t wake_send_; // guarded by mutex_
+
+    // registered clients, shared between the reactor thread and the others
+    std::vector<Entry> entries_;
+    std::mutex mutex_;
+    bool changed_ = false;
+    // The snapshot below may still refer to removed clients while a poll()
+    // is in progress. remove() waits for a new snapshot or the end of poll().
+    std::condition_variable released_;
+    bool polling_ = false;
+    std::thread::id poll_thread_;
+    std::size_t n_updates_ = 0;
+
+    // snapshot of the registered clients used by the reactor thread
+    std::vector<Entry> active_;
+    // the first item is the wake-up socket, followed by the clients in active_
+    std::vector<zmq::pollitem_t> items_;
+
+    std::atomic<bool> running_;
+
+    // must be called with mutex_ locked
+    void wakeUp() {
+        zmq::message_t msg;
+        wake_send_.send(msg, ZMQ_DONTWAIT);
+    }
+
+    // must be called with mutex_ locked
+    std::vector<Entry>::iterator find(Client* client) {
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->client == client) return it;
+        }
+        return entries_.end();
+    }
+
+    void insert(Entry&& entry) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (find(entry.client) != entries_.end())
+            throw std::logic_error("The client has already been registered!");
+        entries_.push_back(std::move(entry));
+        changed_ = true;
+        wakeUp();
+    }
+
+    /*
+     * Update the snapshot of the registered clients.
+     *
+     * Return true if it has been changed.
+     */
+    bool update() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!changed_) return false;
+
+        active_ = entries_;
+        items_.resize(1);
+        for (auto& entry : active_)
+            items_.push_back({static_cast<void*>(entry.client->socket()), 0, ZMQ_POLLIN, 0});
+        changed_ = false;
+        ++n_updates_;
+        released_.notify_all();
+        return true;
+    }
+
+    // Mark the current thread as polling until it goes out of scope.
+    class PollGuard {
+        Reactor& reactor_;
+
+    public:
+        explicit PollGuard(Reactor& reactor) : reactor_(reactor) {
+            std::lock_guard<std::mutex> lock(reactor_.mutex_);
+            if (reactor_.polling_)
+                throw std::logic_error("The reactor is already polled in another thread!");
+            reactor_.polling_ = true;
+            reactor_.poll_thread_ = std::this_thread::get_id();
+        }
+
+        ~PollGuard() {
+            std::lock_guard<std::mutex> lock(reactor_.mutex_);
+            reactor_.polling_ = false;
+            reactor_.poll_thread_ = std::thread::id();
+            reactor_.released_.notify_all();
+        }
+    };
+
+    bool hasChanged() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return changed_;
+    }
+
+    /*
+     * Pass all the available data of a client to its callback.
+     *
+     * Return the number of trains dispatched.
+     */
+    std::size_t dispatch(Entry& entry) {
+        std::size_t n = 0;
+        TrainData data;
+        while (entry.client->tryNext(data)) {
+            ++n;
+            if (entry.once) {
+                // unregister first so that the client can be registered
+                // again in the callback
+                remove(*entry.client);
+                entry.callback(data);
+                break;
+            }
+            entry.callback(data);
+            // The client may have been removed in the callback.
+            if (hasChanged()) break;
+        }
+        return n;
+    }
+
+    /*
+     * Notify the one-shot entries which have passed their deadlines.
+     */
+    void expire() {
+        auto now = clock::now();
+        for (auto& entry : active_) {
+            if (entry.once && entry.deadline <= now) {
+                remove(*entry.client);
+                entry.on_timeout();
+            }
+        }
+    }
+
+    static clock::time_point toDeadline(double timeout) {
+        if (timeout < 0) return clock::time_point::max();
+        return clock::now() + std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(timeout));
+    }
+
+    // Return the poll timeout in millisecond bounded by the nearest deadline.
+    long pollTimeout(double timeout) const {
+        auto deadline = toDeadline(timeout);
+        for (auto& entry : active_) {
+            if (entry.once && entry.deadline < deadline) deadline = entry.deadline;
+        }
+
+        if (deadline == clock::time_point::max()) return -1;
+        auto now = clock::now();
+        if (deadline <= now) return 0;
+        // round up to not wake up before the deadline
+        return static_cast<long>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1);
+    }
+
+public:
+    Reactor()
+        : ctx_(0),
+          wake_recv_(ctx_, ZMQ_PAIR),
+          wake_send_(ctx_, ZMQ_PAIR),
+          running_(false) {
+        std::stringstream ss;
+        ss << "inproc://karabo-bridge-reactor-" << this;
+        wake_recv_.bind(ss.str());
+        wake_send_.connect(ss.str());
+        items_.push_back({static_cast<void*>(wake_recv_), 0, ZMQ_POLLIN, 0});
+    }
+
+    ~Reactor() = default;
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    /*
+     * Register a connected client.
+     *
+     * The client must not be used elsewhere while it is registered and it
+     * must outlive its registration. The callback is called in the reactor
+     * thread.
+     */
+    void add(Client& client, Callback callback) {
+        insert({&client, std::move(callback), false, nullptr, clock::time_point::max()});
+    }
+
+    /*
+     * Unregister a client.
+     *
+     * If it is called from another thread while the reactor is running,
+     * it blocks until the reactor thread no longer uses the client, e.g.
+     * until its callback has returned. The client can then be destroyed.
+     *
+     * Return false if the client is not registered.
+     */
+    bool remove(Client& client) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = find(&client);
+        if (it == entries_.end()) return false;
+        entries_.erase(it);
+        changed_ = true;
+        wakeUp();
+
+        // The reactor thread itself, e.g. a callback, is not using the
+        // client any more once it returns.
+        if (polling_ && poll_thread_ != std::this_thread::get_id()) {
+            auto n_updates = n_updates_;
+            released_.wait(lock, [this, n_updates]() {
+                return !polling_ || n_updates_ != n_updates;
+            });
+        }
+        return true;
+    }
+
+    std::size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+    /*
+     * Return a future of the next data of a connected client.
+     *
+     * Unlike Client::next(), which returns an empty map on timeout, the
+     * future throws ZmqTimeoutError if no data arrived before timeout.
+     * The client is registered until then. The data are received in the
+     * reactor thread, which must be running (run() or repeated poll()) for
+     * the future to become ready.
+     *
+     * @param timeout: timeout in second. Negative for infinite.
+     *
+     * Exceptions:
+     * std::logic_error if the client has already been registered
+     */
+    std::future<TrainData> nextAsync(Client& client, double timeout=-1.) {
+        auto promise = std::make_shared<std::promise<TrainData>>();
+        auto future = promise->get_future();
+        insert({&client,
+                [promise](TrainData& data) { promise->set_value(std::move(data)); },
+                true,
+                [promise]() { promise->set_exception(std::make_exception_ptr(ZmqTimeoutError())); },
+                toDeadline(timeout)});
+        return future;
+    }
+
+#ifdef KARABO_BRIDGE_HAS_COROUTINE
+    /*
+     * Awaitable returned by awaitNext(). The coroutine is resumed in the
+     * reactor thread.
+     */
+    class NextAwaiter {
+        Reactor& reactor_;
+        Client& client_;
+        double timeout_;
+        TrainData data_;
+        bool timed_out_ = false;
+
+    public:
+        NextAwaiter(Reactor& reactor, Client& client, double timeout)
+            : reactor_(reactor), client_(client), timeout_(timeout) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            reactor_.insert({&client_,
+                             [this, handle](TrainData& data) {
+                                 data_ = std::move(data);
+                                 handle.resume();
+                             },
+                             true,
+                             [this, handle]() {
+                                 timed_out_ = true;
+                                 handle.resume();
+                             },
+                             toDeadline(timeout_)});
+        }
+
+        TrainData await_resume() {
+            if (timed_out_) throw ZmqTimeoutError();
+            return std::move(data_);
+        }
+    };
+
+    /*
+     * C++20 counterpart of nextAsync():
+     *
+     *     auto data_pkg = co_await reactor.awaitNext(client, timeout);
+     */
+    NextAwaiter awaitNext(Client& client, double timeout=-1.) {
+        return NextAwaiter(*this, client, timeout);
+    }
+#endif
+
+    /*
+     * Wait for data of any registered client and dispatch all the
+     * available data.
+     *
+     * @param timeout: maximum waiting time in second. Negative for infinite.
+     *
+     * Return the number of trains dispatched.
+     *
+     * Exceptions:
+     * std::logic_error if the reactor is being polled in another thread
+     */
+    std::size_t poll(double timeout=-1.) {
+        PollGuard guard(*this);
+        update();
+        expire();
+        update();
+
+        // send the "next" requests and dispatch the data already received
+        std::size_t n = 0;
+        for (auto& entry : active_) {
+            n += dispatch(entry);
+            if (update()) return n;
+        }
+        if (n > 0) return n;
+
+        zmq::poll(items_.data(), items_.size(), pollTimeout(timeout));
+
+        if (items_[0].revents & ZMQ_POLLIN) {
+            zmq::message_t msg;
+            while (wake_recv_.recv(&msg, ZMQ_DONTWAIT)) {}
+        }
+
+        for (std::size_t i = 1; i < items_.size(); ++i) {
+            if (!(items_[i].revents & ZMQ_POLLIN)) continue;
+            n += dispatch(active_[i - 1]);
+            if (update()) break;
+        }
+        return n;
+    }
+
+    /*
+     * Run the event loop in the current thread until stop() is called.
+     */
+    void run() {
+        running_ = true;
+        while (running_) poll();
+    }
+
+    /*
+     * Stop the event loop. It can be called from any thread.
+     */
+    void stop() {
+        running_ = false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        wakeUp();
+    }
+
+    bool isRunning() const { return running_; }
+};
+
+} // karabo_bridge
+
+#endif //KARABO_BRIDGE_KB_REACTOR_HPP
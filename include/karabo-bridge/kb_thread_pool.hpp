@@ -0,0 +1,193 @@
+/*
+    Karabo bridge thread pool.
+
+    Copyright (c) 2018, European X-Ray Free-Electron Laser Facility GmbH
+    All rights reserved.
+
+    You should have received a copy of the 3-Clause BSD License along with this
+    program. If not, see <https://opensource.org/licenses/BSD-3-Clause>
+
+    Author: Jun Zhu, zhujun981661@gmail.com
+*/
+
+#ifndef KARABO_BRIDGE_KB_THREAD_POOL_HPP
+#define KARABO_BRIDGE_KB_THREAD_POOL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <vector>
+
+
+namespace karabo_bridge {
+
+namespace detail {
+
+/*
+ * Small fixed-size thread pool which runs the iterations of a loop in
+ * parallel.
+ *
+ * Only one loop can run at a time, i.e. the pool must not be used by
+ * several threads concurrently.
+ */
+class ThreadPool {
+
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+
+    // the loop being run, guarded by mutex_
+    const std::function<void(std::size_t)>* task_ = nullptr;
+    std::size_t n_ = 0;
+    std::size_t next_ = 0; // next iteration to run
+    std::size_t remaining_ = 0; // iterations not finished yet
+    std::exception_ptr error_;
+    bool stop_ = false;
+
+    /*
+     * Run the iterations of the current loop until none is left.
+     */
+    void runTasks(std::unique_lock<std::mutex>& lock) {
+        while (task_ && next_ < n_) {
+            auto i = next_++;
+            auto task = task_;
+            lock.unlock();
+
+            std::exception_ptr error;
+            try {
+                (*task)(i);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            if (error && !error_) error_ = error;
+            if (--remaining_ == 0) done_cv_.notify_all();
+        }
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            start_cv_.wait(lock, [this]() { return stop_ || (task_ && next_ < n_); });
+            if (stop_) return;
+            runTasks(lock);
+        }
+    }
+
+public:
+    /*
+     * Constructor.
+     *
+     * @param n_threads: number of worker threads. The calling thread also
+     *                   runs iterations.
+     */
+    explicit ThreadPool(std::size_t n_threads) {
+        for (std::size_t i = 0; i < n_threads; ++i)
+            threads_.emplace_back(&ThreadPool::work, this);
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /*
+     * Run task(i) for i in [0, n) and wait until all of them finish.
+     *
+     * Exceptions:
+     * the first exception raised by a task is rethrown
+     */
+    void parallelFor(std::size_t n, const std::function<void(std::size_t)>& task) {
+        if (n == 0) return;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        task_ = &task;
+        n_ = n;
+        next_ = 0;
+        remaining_ = n;
+        error_ = nullptr;
+        start_cv_.notify_all();
+
+        runTasks(lock);
+        done_cv_.wait(lock, [this]() { return remaining_ == 0; });
+
+        task_ = nullptr;
+        auto error = error_;
+        error_ = nullptr;
+        lock.unlock();
+
+        if (error) std::rethrow_exception(error);
+    }
+
+    std::size_t size() const { return threads_.size(); }
+};
+
+/*
+ * Process-wide pool which splits the work on large arrays, e.g. their
+ * conversion, among the threads of the machine.
+ *
+ * Unlike ThreadPool, it can be used by several threads. A loop is only
+ * run in parallel if the pool is idle, otherwise it is left to the caller.
+ */
+class SharedThreadPool {
+
+    // A few threads already saturate the memory bandwidth.
+    static constexpr std::size_t MAX_THREADS = 8;
+
+    std::mutex mutex_;
+    ThreadPool pool_;
+
+    static std::size_t defaultSize() {
+        std::size_t n = std::thread::hardware_concurrency();
+        if (n > MAX_THREADS) n = MAX_THREADS;
+        // the calling thread also runs iterations
+        return n > 1 ? n - 1 : 0;
+    }
+
+public:
+    SharedThreadPool() : pool_(defaultSize()) {}
+
+    /*
+     * Run task(i) for i in [0, n) in parallel and wait until all of them
+     * finish.
+     *
+     * Return false without running any task if the pool is being used by
+     * another thread or has no worker thread.
+     *
+     * Exceptions:
+     * the first exception raised by a task is rethrown
+     */
+    bool tryParallelFor(std::size_t n, const std::function<void(std::size_t)>& task) {
+        std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+        if (!lock.owns_lock() || pool_.size() == 0) return false;
+        pool_.parallelFor(n, task);
+        return true;
+    }
+
+    // number of worker threads
+    std::size_t size() const { return pool_.size(); }
+};
+
+// Return the process-wide pool, which is created on first use.
+inline SharedThreadPool& sharedPool() {
+    static SharedThreadPool pool;
+    return pool;
+}
+
+} // detail
+
+} // karabo_bridge
+
+#endif //KARABO_BRIDGE_KB_THREAD_POOL_HPP
@@ -134,7 +134,6 @@ void dmi::MainWindow::initConnections()
   img_proc_->start();
 
   connect(img_proc_, &dmi::ImageProcessor::newFrame, image_analysis_, &ImageAnalysisWidget::updateImage);
-  connect(img_proc_, &dmi::ImageProcessor::imageProcessed, broker_, &dmi::DataBroker::dataProcessed);
 
   connect(broker_, &dmi::DataBroker::newSources, [this](const QStringList& srcs)
   {
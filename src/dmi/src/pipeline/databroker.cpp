@@ -86,10 +86,17 @@ void dmi::DataBroker::run()
         for (auto it = item.cbegin(); it != item.cend(); ++it)
         {
           std::string src = it->toStdString();
+          karabo_bridge::NDArray* array = nullptr;
           auto m_it = data_pkg.find(src);
           if (m_it != data_pkg.end())
           {
-            item_data.push_back(m_it->second.array[item.getProperty().toStdString()].data());
+            auto a_it = m_it->second.array.find(item.getProperty().toStdString());
+            if (a_it != m_it->second.array.end()) array = &a_it->second;
+          }
+          if (array)
+          {
+            item_data.push_back(array->data());
+            meta.owners.push_back(array->owner());
             meta.tid = m_it->second.metadata["timestamp.tid"].as<uint64_t>();
             meta.source_name = src;
           } else
@@ -103,7 +110,9 @@ void dmi::DataBroker::run()
         auto it = data_pkg.find(src);
         if (it != data_pkg.end())
         {
-          item_data.push_back(it->second.array.at(item.getProperty().toStdString()).data());
+          auto& array = it->second.array.at(item.getProperty().toStdString());
+          item_data.push_back(array.data());
+          meta.owners.push_back(array.owner());
           meta.tid = it->second.metadata["timestamp.tid"].as<uint64_t>();
           meta.source_name = src;
         }
@@ -114,9 +123,6 @@ void dmi::DataBroker::run()
         queue_->push(std::make_pair(std::move(meta), std::move(item_data)));
       }
     }
-
-    // maintain the data lifetime
-    kb_queue_.emplace_back(std::move(data_pkg));
   }
 }
 
@@ -140,8 +146,3 @@ std::shared_ptr<dmi::PipeLineQueue> dmi::DataBroker::outputChannel()
 {
   return queue_;
 }
-
-void dmi::DataBroker::dataProcessed()
-{
-  kb_queue_.pop_front();
-}
\ No newline at end of file
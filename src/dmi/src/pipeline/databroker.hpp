@@ -11,7 +11,6 @@
 #define KARABO_BRIDGE_PIPE_BRIDGE_HPP
 
 #include <memory>
-#include <deque>
 
 #include <tbb/concurrent_queue.h>
 
@@ -55,8 +54,6 @@ public slots:
 
   void updateSources(const SourceItem& item, bool checked);
 
-  void dataProcessed();
-
 signals:
   // emitted when a new 1D data is ready
   void newLine();
@@ -73,7 +70,6 @@ private:
   QMutex mutex_;
 
   std::shared_ptr<PipeLineQueue> queue_;
-  std::deque<std::map<std::string, karabo_bridge::kb_data>> kb_queue_;
 };
 
 } //dmi
@@ -64,8 +64,6 @@ void dmi::ImageProcessor::run()
                                                 colored_view.step,
                                                 QImage::Format_RGB888)));
       }
-
-      emit imageProcessed();
     }
     msleep(1);
   }
@@ -35,8 +35,6 @@ public:
 signals:
   // emitted when a new frame is ready
   void newFrame(QPixmap pix);
-  // emitted after processing an image data
-  void imageProcessed();
 
 public slots:
   // set the image lower threshold
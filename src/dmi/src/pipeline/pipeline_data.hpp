@@ -11,7 +11,9 @@
 #define KBCPP_DMI_PIPELINE_DATA_HPP
 
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <QDebug>
 
@@ -26,6 +28,8 @@ struct MetaData
   std::size_t tid;
   std::string source_category;
   std::string source_name;
+  // keep the received frames, which PipeLineData points into, alive
+  std::vector<std::shared_ptr<const void>> owners;
 };
 
 inline QDebug operator<<(QDebug debug, const MetaData &data)
@@ -0,0 +1,101 @@
+//
+// Allocation tests. They are built into their own executable since the
+// allocation hook below replaces malloc() for the whole process.
+//
+#include <cstdlib>
+
+#include <gtest/gtest.h>
+
+#include "karabo-bridge/kb_client.hpp"
+
+#include "test_utils.hpp"
+
+
+#ifdef __GLIBC__
+
+/*
+ * Count the heap allocations of the current thread while counting is
+ * enabled. malloc() itself is replaced, so that the chunks of the msgpack
+ * zones and the buffers of libzmq are counted together with operator new.
+ * The replacements forward to the glibc allocator. It does not work with
+ * the sanitizers, which replace malloc() as well.
+ */
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t n, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+}
+
+namespace {
+thread_local bool count_allocations = false;
+thread_local std::size_t n_allocations = 0;
+}
+
+extern "C" {
+
+void* malloc(std::size_t size) noexcept {
+    if (count_allocations) ++n_allocations;
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t n, std::size_t size) noexcept {
+    if (count_allocations) ++n_allocations;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, std::size_t size) noexcept {
+    if (count_allocations) ++n_allocations;
+    return __libc_realloc(ptr, size);
+}
+
+} // extern "C"
+
+
+namespace karabo_bridge {
+
+TEST(TestClient, TestRecycledTrains) {
+    ClientOptions options;
+    options.type = SocketType::PULL;
+    options.timeout = 1.;
+    options.context = createContext(1);
+
+    zmq::socket_t server(*options.context, ZMQ_PUSH);
+    server.setsockopt(ZMQ_LINGER, 0);
+    server.bind("inproc://test-recycled-trains");
+    Client client(options);
+    client.connect("inproc://test-recycled-trains");
+
+    std::map<std::string, kb_data> data_pkg;
+    std::size_t allocations = 0;
+    for (int tid = 0; tid < 20; ++tid) {
+        // a train of one source with "msgpack" and array data
+        sendTrain(server, "SPB_DET_AGIPD1M-1/DET/detector", tid,
+                  "image.data.with.a.long.path", {4, 4});
+
+        // The frames are allocated by the sending thread. All the other
+        // allocations of the receiving thread are counted, including the
+        // chunks of the msgpack zones the frames are unpacked into.
+        count_allocations = true;
+        n_allocations = 0;
+        bool received = client.next(data_pkg);
+        for (auto& v : data_pkg) v.second.decode();
+        count_allocations = false;
+        // the first trains warm up the caches and the recycled containers
+        if (tid >= 5) allocations += n_allocations;
+
+        ASSERT_TRUE(received);
+        ASSERT_EQ(1, data_pkg.size());
+        auto& kbdt = data_pkg["SPB_DET_AGIPD1M-1/DET/detector"];
+        EXPECT_EQ(tid, kbdt.metadata["timestamp.tid"].as<int>());
+        EXPECT_EQ(tid, kbdt["header.trainId"].as<int>());
+        EXPECT_EQ(100, kbdt["detector.name"].view().size());
+        EXPECT_EQ(tid, kbdt.array["image.data.with.a.long.path"].data<float>()[15]);
+    }
+    EXPECT_EQ(0, allocations);
+    // the array header and the layout of the "msgpack" data
+    EXPECT_EQ(2, client.schemaMisses());
+}
+
+} // karabo_bridge
+
+#endif // __GLIBC__
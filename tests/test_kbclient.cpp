@@ -3,11 +3,20 @@
 //
 #include <iostream>
 #include <future>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <thread>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
 #include "karabo-bridge/kb_client.hpp"
+#include "karabo-bridge/kb_async_client.hpp"
+#include "karabo-bridge/kb_multi_client.hpp"
+#include "karabo-bridge/kb_reactor.hpp"
+
+#include "test_utils.hpp"
 
 
 namespace karabo_bridge {
@@ -23,7 +32,7 @@ TEST(TestClient, TestTimeout) {
     client.connect("tcp://localhost:12345");
 
     auto future = std::async(std::launch::async, [&client]() {
-        // test the internal recv_ready_ flag
+        // a timed out request must not be sent again
         client.next();
         client.next();
     });
@@ -40,4 +49,632 @@ TEST(TestClient, TestTimeout) {
     delete client_inf; // close the blocking socket
 }
 
+TEST(TestClient, TestPrefetchTimeout) {
+    int timeout = 100; // in millisecond
+    Client client(0.001 * timeout, 4);
+    client.connect("tcp://localhost:12347");
+
+    auto future = std::async(std::launch::async, [&client]() {
+        // the window of in-flight requests is full after the first call
+        EXPECT_TRUE(client.next().empty());
+        EXPECT_TRUE(client.next().empty());
+    });
+    EXPECT_TRUE(future.wait_for(std::chrono::milliseconds(3*timeout)) == std::future_status::ready);
+}
+
+TEST(TestClient, TestPrefetch) {
+    const std::size_t prefetch = 3;
+    const int n_trains = 10;
+
+    ClientOptions options;
+    options.timeout = 1.;
+    options.prefetch = prefetch;
+    options.context = createContext(1);
+
+    zmq::socket_t server(*options.context, ZMQ_ROUTER);
+    server.setsockopt(ZMQ_LINGER, 0);
+    server.setsockopt(ZMQ_RCVTIMEO, 1000);
+    server.bind("inproc://test-prefetch");
+    Client client(options);
+    client.connect("inproc://test-prefetch");
+
+    // Reply to the oldest request after collecting the ones which have
+    // arrived. Return the maximum number of requests in flight.
+    auto server_loop = std::async(std::launch::async, [&server, n_trains]() {
+        std::deque<zmq::message_t> identities;
+        std::size_t max_pending = 0;
+        for (int tid = 0; tid < n_trains; ++tid) {
+            while (true) {
+                zmq::message_t identity, delimiter, request;
+                if (!server.recv(&identity, identities.empty() ? 0 : ZMQ_DONTWAIT)) break;
+                server.recv(&delimiter);
+                server.recv(&request);
+                EXPECT_EQ("next", std::string(static_cast<const char*>(request.data()),
+                                              request.size()));
+                identities.push_back(std::move(identity));
+            }
+            if (identities.empty()) break; // timeout
+            max_pending = std::max(max_pending, identities.size());
+
+            std::vector<zmq::message_t> parts;
+            parts.push_back(std::move(identities.front()));
+            parts.emplace_back();
+            for (auto& part : packTrain("camera", tid)) parts.push_back(std::move(part));
+            sendMultipart(server, parts);
+            identities.pop_front();
+        }
+        return max_pending;
+    });
+
+    for (int tid = 0; tid < n_trains; ++tid) {
+        auto data = client.next();
+        ASSERT_EQ(1u, data.size());
+        EXPECT_EQ(static_cast<uint64_t>(tid), trainId(data, "camera"));
+    }
+
+    ASSERT_TRUE(server_loop.wait_for(std::chrono::milliseconds(2000)) == std::future_status::ready);
+    auto max_pending = server_loop.get();
+    EXPECT_GE(max_pending, 1u);
+    EXPECT_LE(max_pending, prefetch);
+}
+
+TEST(TestClient, TestSocketType) {
+    int timeout = 100; // in millisecond
+
+    Client client_pull(SocketType::PULL, 0.001 * timeout);
+    EXPECT_EQ(SocketType::PULL, client_pull.socketType());
+    EXPECT_THROW(client_pull.subscribe("abc"), std::logic_error);
+    client_pull.connect("tcp://localhost:12349");
+
+    Client client_sub(SocketType::SUB, 0.001 * timeout);
+    EXPECT_EQ(SocketType::SUB, client_sub.socketType());
+    EXPECT_NO_THROW(client_sub.subscribe());
+    client_sub.connect("tcp://localhost:12350");
+
+    auto future = std::async(std::launch::async, [&client_pull, &client_sub]() {
+        EXPECT_TRUE(client_pull.next().empty());
+        EXPECT_TRUE(client_sub.next().empty());
+    });
+    EXPECT_TRUE(future.wait_for(std::chrono::milliseconds(4*timeout)) == std::future_status::ready);
+}
+
+TEST(TestClient, TestPull) {
+    ClientOptions options;
+    options.type = SocketType::PULL;
+    options.timeout = 1.;
+    options.context = createContext(1);
+
+    zmq::socket_t server(*options.context, ZMQ_PUSH);
+    server.setsockopt(ZMQ_LINGER, 0);
+    server.bind("inproc://test-pull");
+    Client client(options);
+    client.connect("inproc://test-pull");
+
+    // no request is sent
+    for (int tid = 0; tid < 3; ++tid) sendTrain(server, "camera", tid);
+    for (int tid = 0; tid < 3; ++tid) {
+        auto data = client.next();
+        ASSERT_EQ(1u, data.size());
+        EXPECT_EQ(static_cast<uint64_t>(tid), trainId(data, "camera"));
+        EXPECT_EQ(static_cast<uint64_t>(tid), data["camera"]["header.trainId"].as<uint64_t>());
+    }
+}
+
+TEST(TestClient, TestSub) {
+    ClientOptions options;
+    options.type = SocketType::SUB;
+    options.timeout = 0.05;
+    options.context = createContext(1);
+
+    zmq::socket_t server(*options.context, ZMQ_PUB);
+    server.setsockopt(ZMQ_LINGER, 0);
+    server.bind("inproc://test-sub");
+
+    // the header frame of the trains of "source-A" starts with the topic
+    msgpack::sbuffer topic;
+    msgpack::packer<msgpack::sbuffer> packer(topic);
+    packer.pack_map(3);
+    packer.pack(std::string("source"));
+    packer.pack(std::string("source-A"));
+
+    Client client(options);
+    client.subscribe(std::string(topic.data(), topic.size()));
+    client.connect("inproc://test-sub");
+
+    // The messages published before the subscription has reached the
+    // publisher are dropped.
+    std::map<std::string, kb_data> data;
+    for (int tid = 0; tid < 100 && data.empty(); ++tid) {
+        sendTrain(server, "source-B", tid);
+        sendTrain(server, "source-A", tid);
+        data = client.next();
+    }
+    ASSERT_EQ(1u, data.size());
+    auto tid = trainId(data, "source-A");
+
+    sendTrain(server, "source-B", tid + 1);
+    sendTrain(server, "source-A", tid + 1);
+    data = client.next();
+    ASSERT_EQ(1u, data.size());
+    EXPECT_EQ(tid + 1, trainId(data, "source-A"));
+}
+
+TEST(TestClient, TestOptions) {
+    ClientOptions options;
+    options.timeout = 0.1;
+    options.rcvbuf = 1 << 20;
+    options.rcvhwm = 2;
+    options.max_msg_size = 1 << 30;
+    options.tcp_keepalive = 1;
+    options.context = createContext(2);
+
+    Client client1(options);
+    Client client2(options);
+    EXPECT_EQ(3, options.context.use_count()); // shared by both clients
+    EXPECT_EQ(100, client1.socket().getsockopt<int>(ZMQ_RCVTIMEO));
+    EXPECT_EQ(1 << 20, client1.socket().getsockopt<int>(ZMQ_RCVBUF));
+    EXPECT_EQ(2, client1.socket().getsockopt<int>(ZMQ_RCVHWM));
+    EXPECT_EQ(1 << 30, client2.socket().getsockopt<int64_t>(ZMQ_MAXMSGSIZE));
+    EXPECT_EQ(1, client2.socket().getsockopt<int>(ZMQ_TCP_KEEPALIVE));
+
+    client1.connect("tcp://localhost:12354");
+    EXPECT_TRUE(client1.next().empty());
+}
+
+TEST(TestClient, TestLatestOnly) {
+    ClientOptions options;
+    options.type = SocketType::PULL;
+    options.timeout = 1.;
+    options.latest_only = true;
+    options.context = createContext(1);
+
+    zmq::socket_t server(*options.context, ZMQ_PUSH);
+    server.setsockopt(ZMQ_LINGER, 0);
+    server.bind("inproc://test-latest-only");
+    Client client(options);
+    client.connect("inproc://test-latest-only");
+
+    for (int tid = 0; tid < 3; ++tid) sendTrain(server, "camera", tid);
+    auto data = client.next();
+    ASSERT_EQ(1u, data.size());
+    EXPECT_EQ(2u, trainId(data, "camera"));
+    EXPECT_EQ(2u, client.skipped());
+}
+
+TEST(TestClient, TestLatestOnlyReq) {
+    // ignored without prefetch
+    ClientOptions options;
+    options.timeout = 1.;
+    options.latest_only = true;
+    options.context = createContext(1);
+
+    zmq::socket_t server(*options.context, ZMQ_REP);
+    server.setsockopt(ZMQ_LINGER, 0);
+    server.setsockopt(ZMQ_RCVTIMEO, 1000);
+    server.bind("inproc://test-latest-only-req");
+    Client client(options);
+    client.connect("inproc://test-latest-only-req");
+
+    auto server_loop = std::async(std::launch::async, [&server]() {
+        zmq::message_t request;
+        if (server.recv(&request)) sendTrain(server, "camera", 1);
+    });
+
+    std::map<std::string, kb_data> data;
+    EXPECT_NO_THROW(data = client.next());
+    server_loop.wait();
+    ASSERT_EQ(1u, data.size());
+    EXPECT_EQ(1u, trainId(data, "camera"));
+    EXPECT_EQ(0u, client.skipped());
+}
+
+TEST(TestClient, TestBatchNext) {
+    int timeout = 100; // in millisecond
+    Client client(-1., 4);
+    client.connect("tcp://localhost:12359");
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto data = client.next(8, 0.001 * timeout);
+    auto dt = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - start).count();
+    EXPECT_TRUE(data.empty());
+    EXPECT_GE(dt, timeout);
+    EXPECT_LE(dt, 2 * timeout);
+
+    EXPECT_TRUE(client.next(0, 0.).empty());
+}
+
+TEST(TestClient, TestBatchNextWithData) {
+    ClientOptions options;
+    options.type = SocketType::PULL;
+    options.context = createContext(1);
+
+    zmq::socket_t server(*options.context, ZMQ_PUSH);
+    server.setsockopt(ZMQ_LINGER, 0);
+    server.bind("inproc://test-batch-next");
+    Client client(options);
+    client.connect("inproc://test-batch-next");
+
+    for (int tid = 0; tid < 3; ++tid) sendTrain(server, "camera", tid);
+
+    auto data = client.next(2, 1.);
+    ASSERT_EQ(2u, data.size());
+    EXPECT_EQ(0u, trainId(data[0], "camera"));
+    EXPECT_EQ(1u, trainId(data[1], "camera"));
+
+    // fewer trains on timeout
+    auto start = std::chrono::steady_clock::now();
+    data = client.next(2, 0.1);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+    ASSERT_EQ(1u, data.size());
+    EXPECT_EQ(2u, trainId(data[0], "camera"));
+}
+
+TEST(TestClient, TestTryNext) {
+    Client client;
+    client.connect("tcp://localhost:12351");
+
+    std::map<std::string, kb_data> data_pkg;
+    EXPECT_FALSE(client.tryNext(data_pkg));
+    EXPECT_FALSE(client.tryNext(data_pkg)); // no second request is sent
+}
+
+TEST(TestSourceFilter, TestGeneral) {
+    SourceFilter filter;
+    EXPECT_TRUE(filter.empty());
+    EXPECT_TRUE(filter.selectsSource("any"));
+    EXPECT_TRUE(filter.selectsKey("any", "any"));
+
+    filter.add("SA1_XTD2_XGM/DOOCS/MAIN")
+          .add("SPB_DET_AGIPD1M-1/DET/*CH0:xtdf", {"image.data", "header.*"})
+          .add("SPB_DET_AGIPD1M-1/DET/1?CH0:xtdf", {"image.gain"});
+    EXPECT_FALSE(filter.empty());
+
+    EXPECT_TRUE(filter.selectsSource("SA1_XTD2_XGM/DOOCS/MAIN"));
+    EXPECT_FALSE(filter.selectsSource("SA1_XTD2_XGM/DOOCS/MAIN:output"));
+    EXPECT_TRUE(filter.selectsSource("SPB_DET_AGIPD1M-1/DET/0CH0:xtdf"));
+    EXPECT_TRUE(filter.selectsSource("SPB_DET_AGIPD1M-1/DET/15CH0:xtdf"));
+    EXPECT_FALSE(filter.selectsSource("SPB_DET_AGIPD1M-1/DET/0CH0:output"));
+
+    EXPECT_TRUE(filter.selectsAllKeys("SA1_XTD2_XGM/DOOCS/MAIN"));
+    EXPECT_TRUE(filter.selectsKey("SA1_XTD2_XGM/DOOCS/MAIN", "pulseEnergy.photonFlux"));
+    EXPECT_FALSE(filter.selectsAllKeys("SPB_DET_AGIPD1M-1/DET/0CH0:xtdf"));
+    EXPECT_TRUE(filter.selectsKey("SPB_DET_AGIPD1M-1/DET/0CH0:xtdf", "image.data"));
+    EXPECT_TRUE(filter.selectsKey("SPB_DET_AGIPD1M-1/DET/0CH0:xtdf", "header.pulseCount"));
+    EXPECT_FALSE(filter.selectsKey("SPB_DET_AGIPD1M-1/DET/0CH0:xtdf", "image.gain"));
+    // the keys of all the matching patterns are selected
+    EXPECT_TRUE(filter.selectsKey("SPB_DET_AGIPD1M-1/DET/15CH0:xtdf", "image.gain"));
+    EXPECT_TRUE(filter.selectsKey("SPB_DET_AGIPD1M-1/DET/15CH0:xtdf", "image.data"));
+
+    Client client;
+    EXPECT_TRUE(client.filter().empty());
+    client.setFilter(filter);
+    EXPECT_TRUE(client.filter().selectsSource("SA1_XTD2_XGM/DOOCS/MAIN"));
+}
+
+TEST(TestThreadPool, TestGeneral) {
+    detail::ThreadPool pool(3);
+    EXPECT_EQ(3u, pool.size());
+
+    for (int i = 0; i < 100; ++i) {
+        std::atomic<std::size_t> sum(0);
+        pool.parallelFor(100, [&sum](std::size_t j) { sum += j; });
+        EXPECT_EQ(4950u, sum);
+    }
+
+    EXPECT_THROW(pool.parallelFor(10, [](std::size_t j) {
+        if (j == 5) throw std::runtime_error("error");
+    }), std::runtime_error);
+
+    // the pool is still usable after an exception
+    std::atomic<std::size_t> count(0);
+    pool.parallelFor(10, [&count](std::size_t) { ++count; });
+    EXPECT_EQ(10, count);
+
+    ClientOptions options;
+    options.timeout = 0.1;
+    options.parse_threads = 2;
+    Client client(options);
+    client.connect("tcp://localhost:12361");
+    EXPECT_TRUE(client.next().empty());
+}
+
+TEST(TestMultiClient, TestTimeout) {
+    int timeout = 100; // in millisecond
+    MultiClient client(0.001 * timeout);
+    EXPECT_TRUE(client.next().empty()); // no endpoint
+
+    client.connect("tcp://localhost:12352");
+    client.connect("tcp://localhost:12353");
+    EXPECT_EQ(2, client.size());
+
+    auto future = std::async(std::launch::async, [&client]() {
+        EXPECT_TRUE(client.next().empty());
+    });
+    EXPECT_TRUE(future.wait_for(std::chrono::milliseconds(3*timeout)) == std::future_status::ready);
+
+    EXPECT_EQ(0, client.pending());
+    EXPECT_EQ(0, client.completeTrains());
+    EXPECT_EQ(0, client.partialTrains());
+    EXPECT_EQ(0, client.lateData());
+    EXPECT_EQ(0, client.missingData());
+}
+
+TEST(TestMultiClient, TestFilteredTrain) {
+    ClientOptions options;
+    options.type = SocketType::PULL;
+    options.timeout = 1.;
+    options.context = createContext(1);
+    options.filter.add("source-A");
+    // a train which is not completed in time would be returned as partial
+    MultiClient client(options, 10.);
+
+    std::vector<std::unique_ptr<zmq::socket_t>> servers;
+    for (int i = 0; i < 2; ++i) {
+        servers.emplace_back(new zmq::socket_t(*options.context, ZMQ_PUSH));
+        servers.back()->setsockopt(ZMQ_LINGER, 0);
+        auto endpoint = "inproc://test-multi-client-filter-" + std::to_string(i);
+        servers.back()->bind(endpoint);
+        client.connect(endpoint);
+    }
+
+    // the only source of the second endpoint is filtered out
+    sendTrain(*servers[0], "source-A", 1);
+    sendTrain(*servers[1], "source-B", 1);
+
+    auto start = std::chrono::steady_clock::now();
+    auto train = client.next();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+    ASSERT_EQ(1u, train.size());
+    EXPECT_EQ(1u, train["source-A"]["header.trainId"].as<uint64_t>());
+    EXPECT_EQ(1, client.completeTrains());
+    EXPECT_EQ(0, client.partialTrains());
+    EXPECT_EQ(0, client.missingData());
+}
+
+TEST(TestMultiClient, TestMerge) {
+    ClientOptions options;
+    options.type = SocketType::PULL;
+    options.timeout = 1.;
+    options.context = createContext(1);
+    MultiClient client(options, 0.2);
+
+    std::vector<std::unique_ptr<zmq::socket_t>> servers;
+    for (int i = 0; i < 2; ++i) {
+        servers.emplace_back(new zmq::socket_t(*options.context, ZMQ_PUSH));
+        servers.back()->setsockopt(ZMQ_LINGER, 0);
+        auto endpoint = "inproc://test-multi-client-merge-" + std::to_string(i);
+        servers.back()->bind(endpoint);
+        client.connect(endpoint);
+    }
+
+    // complete
+    sendTrain(*servers[0], "module-0", 1);
+    sendTrain(*servers[1], "module-1", 1);
+    auto train = client.next();
+    ASSERT_EQ(2u, train.size());
+    EXPECT_EQ(1u, trainId(train, "module-0"));
+    EXPECT_EQ(1u, trainId(train, "module-1"));
+    EXPECT_EQ(1u, client.completeTrains());
+
+    // partial after partial_timeout
+    sendTrain(*servers[0], "module-0", 2);
+    auto start = std::chrono::steady_clock::now();
+    train = client.next();
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+    ASSERT_EQ(1u, train.size());
+    EXPECT_EQ(2u, trainId(train, "module-0"));
+    EXPECT_EQ(1u, client.partialTrains());
+    EXPECT_EQ(1u, client.missingData());
+
+    // the missing data arrive late and are discarded
+    sendTrain(*servers[1], "module-1", 2);
+    sendTrain(*servers[1], "module-1", 3);
+    sendTrain(*servers[0], "module-0", 3);
+    train = client.next();
+    ASSERT_EQ(2u, train.size());
+    EXPECT_EQ(3u, trainId(train, "module-1"));
+    EXPECT_EQ(2u, client.completeTrains());
+    EXPECT_EQ(1u, client.partialTrains());
+    EXPECT_EQ(1u, client.lateData());
+    EXPECT_EQ(1u, client.missingData());
+    EXPECT_EQ(0u, client.pending());
+}
+
+TEST(TestReactor, TestGeneral) {
+    Reactor reactor;
+    EXPECT_EQ(0, reactor.poll(0.01));
+
+    Client client1(SocketType::PULL);
+    client1.connect("tcp://localhost:12355");
+    Client client2;
+    client2.connect("tcp://localhost:12356");
+
+    int n_called = 0;
+    auto callback = [&n_called](Reactor::TrainData&) { ++n_called; };
+    reactor.add(client1, callback);
+    reactor.add(client2, callback);
+    EXPECT_THROW(reactor.add(client1, callback), std::logic_error);
+    EXPECT_EQ(2, reactor.size());
+
+    EXPECT_EQ(0, reactor.poll(0.1));
+
+    auto future = std::async(std::launch::async, [&reactor]() { reactor.run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_TRUE(reactor.isRunning());
+    reactor.stop();
+    EXPECT_TRUE(future.wait_for(std::chrono::milliseconds(500)) == std::future_status::ready);
+
+    EXPECT_TRUE(reactor.remove(client1));
+    EXPECT_FALSE(reactor.remove(client1));
+    EXPECT_EQ(1, reactor.size());
+    EXPECT_EQ(0, n_called);
+}
+
+TEST(TestReactor, TestNextAsync) {
+    Reactor reactor;
+    auto loop = std::async(std::launch::async, [&reactor]() { reactor.run(); });
+
+    Client client;
+    client.connect("tcp://localhost:12357");
+
+    auto future = reactor.nextAsync(client, 0.1);
+    EXPECT_THROW(reactor.nextAsync(client), std::logic_error);
+    EXPECT_TRUE(future.wait_for(std::chrono::milliseconds(500)) == std::future_status::ready);
+    EXPECT_THROW(future.get(), ZmqTimeoutError);
+    EXPECT_EQ(0, reactor.size()); // unregistered after timeout
+
+    auto future_inf = reactor.nextAsync(client);
+    EXPECT_TRUE(future_inf.wait_for(std::chrono::milliseconds(200)) == std::future_status::timeout);
+    EXPECT_TRUE(reactor.remove(client));
+    EXPECT_TRUE(future_inf.wait_for(std::chrono::milliseconds(500)) == std::future_status::ready);
+    EXPECT_THROW(future_inf.get(), std::future_error); // broken promise
+
+    reactor.stop();
+    EXPECT_TRUE(loop.wait_for(std::chrono::milliseconds(500)) == std::future_status::ready);
+}
+
+TEST(TestReactor, TestRemoveDuringDispatch) {
+    auto ctx = createContext(1);
+    zmq::socket_t server(*ctx, ZMQ_PUSH);
+    server.setsockopt(ZMQ_LINGER, 0);
+    server.bind("inproc://test-reactor-remove");
+
+    ClientOptions options;
+    options.type = SocketType::PULL;
+    options.context = ctx;
+    std::unique_ptr<Client> client(new Client(options));
+    client->connect("inproc://test-reactor-remove");
+
+    Reactor reactor;
+    std::promise<void> entered;
+    std::atomic<bool> finished(false);
+    reactor.add(*client, [&entered, &finished](Reactor::TrainData&) {
+        entered.set_value();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        finished = true;
+    });
+    auto loop = std::async(std::launch::async, [&reactor]() { reactor.run(); });
+
+    sendTrain(server, "camera", 1);
+
+    ASSERT_TRUE(entered.get_future().wait_for(std::chrono::milliseconds(1000))
+                == std::future_status::ready);
+    // the client is in use by the callback and must not be released before it returns
+    EXPECT_TRUE(reactor.remove(*client));
+    EXPECT_TRUE(finished);
+    client.reset();
+    EXPECT_EQ(0, reactor.size());
+
+    reactor.stop();
+    EXPECT_TRUE(loop.wait_for(std::chrono::milliseconds(500)) == std::future_status::ready);
+}
+
+TEST(TestSpscRingBuffer, TestGeneral) {
+    detail::SpscRingBuffer<std::vector<int>> buffer(2);
+    EXPECT_EQ(2, buffer.capacity());
+    EXPECT_TRUE(buffer.empty());
+
+    std::vector<int> item {1, 2};
+    EXPECT_TRUE(buffer.tryPush(std::move(item)));
+    item = {3};
+    EXPECT_TRUE(buffer.tryPush(std::move(item)));
+    item = {4};
+    EXPECT_FALSE(buffer.tryPush(std::move(item)));
+    EXPECT_THAT(item, ElementsAre(4)); // not moved if the buffer is full
+    EXPECT_EQ(2, buffer.size());
+
+    std::vector<int> out;
+    EXPECT_TRUE(buffer.tryPop(out));
+    EXPECT_THAT(out, ElementsAre(1, 2));
+    EXPECT_TRUE(buffer.tryPush(std::move(item))); // wrap around
+    EXPECT_TRUE(buffer.tryPop(out));
+    EXPECT_THAT(out, ElementsAre(3));
+    EXPECT_TRUE(buffer.tryPop(out));
+    EXPECT_THAT(out, ElementsAre(4));
+    EXPECT_FALSE(buffer.tryPop(out));
+    EXPECT_TRUE(buffer.empty());
+}
+
+TEST(TestSpscRingBuffer, TestConcurrency) {
+    detail::SpscRingBuffer<std::size_t> buffer(16);
+    const std::size_t n = 100000;
+
+    auto producer = std::async(std::launch::async, [&buffer, n]() {
+        for (std::size_t i = 0; i < n; ++i) {
+            std::size_t v = i;
+            while (!buffer.tryPush(std::move(v))) std::this_thread::yield();
+        }
+    });
+
+    std::size_t expected = 0;
+    std::size_t v;
+    while (expected < n) {
+        if (buffer.tryPop(v)) {
+            ASSERT_EQ(expected, v);
+            ++expected;
+        }
+    }
+    producer.wait();
+}
+
+TEST(TestAsyncClient, TestTimeout) {
+    AsyncClient client(4);
+    client.connect("tcp://localhost:12348");
+    client.start();
+    EXPECT_TRUE(client.isRunning());
+
+    AsyncClient::TrainData data;
+    EXPECT_FALSE(client.tryNext(data));
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(client.next(data, 0.1));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+
+    std::vector<AsyncClient::TrainData> batch;
+    EXPECT_EQ(0, client.drain(batch));
+
+    client.stop();
+    EXPECT_FALSE(client.isRunning());
+    EXPECT_EQ(0, client.received());
+    EXPECT_EQ(0, client.dropped());
+}
+
+TEST(TestAsyncClient, TestDropped) {
+    ClientOptions options;
+    options.type = SocketType::PULL;
+    options.context = createContext(1);
+
+    zmq::socket_t server(*options.context, ZMQ_PUSH);
+    server.setsockopt(ZMQ_LINGER, 0);
+    server.bind("inproc://test-async-client");
+    AsyncClient client(options, 2);
+    client.connect("inproc://test-async-client");
+    client.start();
+
+    // the trains after the first two are dropped since nothing is consumed
+    for (int tid = 0; tid < 5; ++tid) sendTrain(server, "camera", tid);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (client.received() < 5 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(5u, client.received());
+    EXPECT_EQ(3u, client.dropped());
+    EXPECT_EQ(2u, client.size());
+
+    AsyncClient::TrainData data;
+    ASSERT_TRUE(client.tryNext(data));
+    EXPECT_EQ(0u, trainId(data, "camera"));
+    ASSERT_TRUE(client.tryNext(data));
+    EXPECT_EQ(1u, trainId(data, "camera"));
+    EXPECT_FALSE(client.tryNext(data));
+
+    // there is room again
+    sendTrain(server, "camera", 5);
+    ASSERT_TRUE(client.next(data, 1.));
+    EXPECT_EQ(5u, trainId(data, "camera"));
+    EXPECT_EQ(3u, client.dropped());
+
+    client.stop();
+}
+
 } // karabo_bridge
\ No newline at end of file
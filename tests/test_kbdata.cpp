@@ -33,10 +33,474 @@ msgpack::object_handle _packBin_t(std::vector<int> x) {
     return msgpack::unpack(sbuf.data(), sbuf.size());
 }
 
+// sum of the elements of an NDArray
+struct SumVisitor {
+    template<typename T>
+    double operator()(T* ptr, std::size_t size) const {
+        double sum = 0;
+        for (std::size_t i = 0; i < size; ++i) sum += ptr[i];
+        return sum;
+    }
+};
+
+// type of the data of a MsgpackObject
+struct TypeVisitor {
+    std::string operator()(const StringView&) const { return "view"; }
+
+    template<typename T>
+    std::string operator()(const std::vector<T>&) const {
+        return "vector of " + dtypeName(dtype_of<T>::value);
+    }
+
+    template<typename T>
+    std::string operator()(const T&) const { return dtypeName(dtype_of<T>::value); }
+};
+
 /*
  * test cases
  */
 
+TEST(TestFrameHeader, TestGeneral) {
+    msgpack::sbuffer sbuf;
+    msgpack::packer<msgpack::sbuffer> packer(sbuf);
+    packer.pack_map(6);
+    packer.pack(std::string("source"));
+    packer.pack(std::string("SPB_DET_AGIPD1M-1/DET/detector"));
+    packer.pack(std::string("metadata"));
+    packer.pack(std::map<std::string, std::string>{{"source", "ignored"}, {"path", "ignored"}});
+    packer.pack(std::string("content"));
+    packer.pack(std::string("array"));
+    packer.pack(std::string("path"));
+    packer.pack(std::string("image.data"));
+    packer.pack(std::string("dtype"));
+    packer.pack(std::string("float32"));
+    packer.pack(std::string("shape"));
+    packer.pack(std::vector<unsigned int>{16, 512, 128});
+
+    zmq::message_t msg(sbuf.data(), sbuf.size());
+    detail::ReusableZone zone;
+    detail::FrameHeader header;
+    ASSERT_EQ(detail::HeaderStatus::OK, detail::parseHeader(msg, zone, header));
+    EXPECT_EQ("array", header.content.str());
+    EXPECT_EQ("SPB_DET_AGIPD1M-1/DET/detector", header.source.str());
+    EXPECT_EQ("image.data", header.path.str());
+    EXPECT_EQ("float32", header.dtype.str());
+    EXPECT_TRUE(header.has_shape);
+    EXPECT_THAT(std::vector<std::size_t>(header.shape.begin(), header.shape.begin() + header.ndim),
+                ElementsAre(16, 512, 128));
+    EXPECT_EQ(4u, detail::itemSize(header.dtype));
+
+    // "content" is missing
+    msgpack::sbuffer sbuf_invalid;
+    msgpack::pack(sbuf_invalid, std::map<std::string, std::string>{{"source", "a"}});
+    zmq::message_t msg_invalid(sbuf_invalid.data(), sbuf_invalid.size());
+    detail::FrameHeader header_invalid;
+    EXPECT_EQ(detail::HeaderStatus::NO_CONTENT, detail::parseHeader(msg_invalid, zone, header_invalid));
+
+    // not msgpack
+    zmq::message_t msg_garbage("\xc1", 1);
+    EXPECT_EQ(detail::HeaderStatus::INVALID, detail::parseHeader(msg_garbage, zone, header_invalid));
+
+    // an array with too many dimensions has its own error
+    msgpack::sbuffer sbuf_ndim;
+    msgpack::packer<msgpack::sbuffer> packer_ndim(sbuf_ndim);
+    packer_ndim.pack_map(2);
+    packer_ndim.pack(std::string("content"));
+    packer_ndim.pack(std::string("array"));
+    packer_ndim.pack(std::string("shape"));
+    packer_ndim.pack(std::vector<unsigned int>(detail::FrameHeader::MAX_NDIM + 1, 2));
+    zmq::message_t msg_ndim(sbuf_ndim.data(), sbuf_ndim.size());
+    EXPECT_EQ(detail::HeaderStatus::TOO_MANY_DIMS, detail::parseHeader(msg_ndim, zone, header_invalid));
+    EXPECT_EQ("Failed to parse the header: 'shape' has more than 8 dimensions!",
+              detail::headerError(detail::HeaderStatus::TOO_MANY_DIMS));
+
+    // a dimension which is not a non-negative integer
+    msgpack::sbuffer sbuf_dim;
+    msgpack::packer<msgpack::sbuffer> packer_dim(sbuf_dim);
+    packer_dim.pack_map(2);
+    packer_dim.pack(std::string("content"));
+    packer_dim.pack(std::string("array"));
+    packer_dim.pack(std::string("shape"));
+    packer_dim.pack(std::vector<int>{16, -1});
+    zmq::message_t msg_dim(sbuf_dim.data(), sbuf_dim.size());
+    EXPECT_EQ(detail::HeaderStatus::INVALID, detail::parseHeader(msg_dim, zone, header_invalid));
+}
+
+TEST(TestSchemaCache, TestGeneral) {
+    detail::SchemaCache cache;
+
+    // array header
+    std::string bytes("header bytes");
+    EXPECT_EQ(nullptr, cache.findHeader(bytes.data(), bytes.size()));
+    detail::SchemaCache::ArrayHeader header;
+    header.bytes = bytes;
+    header.source = "source";
+    header.path = "image.data";
+    header.dtype = "float";
+    header.shape = {16, 512, 128};
+    cache.addHeader(std::move(header));
+    auto cached = cache.findHeader(bytes.data(), bytes.size());
+    ASSERT_NE(nullptr, cached);
+    EXPECT_EQ("image.data", cached->path);
+    EXPECT_EQ(nullptr, cache.findHeader("header byte", 11));
+
+    // layout of the "msgpack" data
+    std::map<std::string, int> data1 {{"b", 1}, {"c", 2}, {"a", 3}};
+    auto oh1 = _packObject_t(data1);
+    auto layout = cache.layout("source");
+    EXPECT_EQ(layout, cache.layout("source"));
+    EXPECT_NE(layout, cache.layout("another source"));
+
+    ObjectMap map1;
+    layout->fill(oh1.get(), map1);
+    EXPECT_EQ(0, layout->hits());
+    EXPECT_EQ(1, layout->misses());
+    ObjectMap map2;
+    layout->fill(oh1.get(), map2);
+    EXPECT_EQ(1, layout->hits());
+    EXPECT_EQ(1, layout->misses());
+    ASSERT_EQ(3, map2.size());
+    EXPECT_EQ(3, map2["a"].as<int>());
+    EXPECT_EQ(1, map2["b"].as<int>());
+    EXPECT_EQ(2, map2["c"].as<int>());
+
+    // the keys have changed
+    std::map<std::string, int> data2 {{"b", 1}, {"c", 2}, {"d", 3}};
+    auto oh2 = _packObject_t(data2);
+    ObjectMap map3;
+    layout->fill(oh2.get(), map3);
+    EXPECT_EQ(1, layout->hits());
+    EXPECT_EQ(2, layout->misses());
+    EXPECT_EQ(3, map3["d"].as<int>());
+
+    EXPECT_EQ(1, cache.layoutHits());
+    EXPECT_EQ(2, cache.layoutMisses());
+
+    // only the selected keys are inserted
+    SourceFilter filter;
+    filter.add("filtered source", {"b", "d"});
+    auto filtered_layout = cache.layout("filtered source", filter);
+    for (int i = 0; i < 2; ++i) {
+        ObjectMap map;
+        filtered_layout->fill(oh2.get(), map);
+        ASSERT_EQ(2, map.size());
+        EXPECT_EQ(1, map["b"].as<int>());
+        EXPECT_EQ(3, map["d"].as<int>());
+    }
+    EXPECT_EQ(1, filtered_layout->hits());
+
+    cache.clear();
+    EXPECT_EQ(nullptr, cache.findHeader(bytes.data(), bytes.size()));
+    EXPECT_EQ(0, cache.layoutMisses());
+}
+
+TEST(TestKbData, TestLazyDecode) {
+    msgpack::sbuffer sbuf;
+    msgpack::pack(sbuf, std::map<std::string, int>{{"a", 1}, {"b", 2}});
+
+    kb_data data;
+    data.appendLazyData(zmq::message_t(sbuf.data(), sbuf.size()),
+                        std::make_shared<detail::LayoutSlot>());
+    EXPECT_TRUE(data.isLazy());
+    EXPECT_EQ(sbuf.size(), data.bytesReceived());
+
+    EXPECT_EQ(2, data["b"].as<int>());
+    EXPECT_FALSE(data.isLazy());
+    EXPECT_EQ(2, std::distance(data.begin(), data.end()));
+
+    // invalid data
+    msgpack::sbuffer sbuf_invalid;
+    msgpack::pack(sbuf_invalid, 1);
+    kb_data data_invalid;
+    data_invalid.appendLazyData(zmq::message_t(sbuf_invalid.data(), sbuf_invalid.size()),
+                                std::make_shared<detail::LayoutSlot>());
+    EXPECT_THROW(data_invalid.decode(), msgpack::type_error);
+}
+
+TEST(TestKbData, TestConcurrentConstAccess) {
+    std::map<std::string, int> values;
+    for (int i = 0; i < 100; ++i) values["key" + std::to_string(i)] = i;
+    msgpack::sbuffer sbuf;
+    msgpack::pack(sbuf, values);
+
+    for (int n = 0; n < 20; ++n) {
+        kb_data data;
+        data.appendLazyData(zmq::message_t(sbuf.data(), sbuf.size()),
+                            std::make_shared<detail::LayoutSlot>());
+        const kb_data& cdata = data;
+
+        // the first access of either thread decodes the data
+        auto count = [&cdata]() { return std::distance(cdata.begin(), cdata.end()); };
+        auto future = std::async(std::launch::async, count);
+        EXPECT_EQ(100, count());
+        EXPECT_EQ(100, future.get());
+        EXPECT_FALSE(data.isLazy());
+
+        // a moved kb_data is still decoded lazily
+        kb_data other;
+        other.appendLazyData(zmq::message_t(sbuf.data(), sbuf.size()),
+                             std::make_shared<detail::LayoutSlot>());
+        kb_data moved(std::move(other));
+        EXPECT_TRUE(moved.isLazy());
+        EXPECT_EQ(42, moved["key42"].as<int>());
+    }
+}
+
+TEST(TestKbData, TestInternedKeys) {
+    auto keys = std::make_shared<KeyTable>();
+    auto key_a = keys->intern("a");
+    auto key_b = keys->intern("b");
+    EXPECT_EQ(key_a, keys->intern("a"));
+    EXPECT_NE(key_a, key_b);
+    EXPECT_EQ("b", keys->name(key_b));
+    EXPECT_EQ(2, keys->size());
+
+    msgpack::sbuffer sbuf;
+    msgpack::pack(sbuf, std::map<std::string, int>{{"b", 2}, {"c", 3}});
+    auto layout = std::make_shared<detail::LayoutSlot>(nullptr, keys);
+
+    for (int i = 0; i < 2; ++i) {  // cache miss and hit
+        kb_data data;
+        data.appendLazyData(zmq::message_t(sbuf.data(), sbuf.size()), layout);
+        EXPECT_EQ(nullptr, data.find(key_a));
+        EXPECT_EQ(2, data[key_b].as<int>());
+        EXPECT_EQ(3, data[keys->intern("c")].as<int>());
+        EXPECT_THROW(data[key_a], std::out_of_range);
+    }
+    EXPECT_EQ(1, layout->hits());
+
+    uint16_t a[4] = {1, 2, 3, 4};
+    kb_data data;
+    data.setKeyTable(keys);
+    data.setArray("a", a, {4}, "uint16_t");
+    EXPECT_EQ(a, data.findArray(key_a)->data<uint16_t>());
+    EXPECT_EQ(nullptr, data.findArray(key_b));
+    EXPECT_THROW(data.array["b"], std::out_of_range);
+
+    // the data inserted by the user are indexed as well
+    auto oh = _packObject_t(5);
+    data.insert(std::make_pair(std::string("d"), MsgpackObject(oh.get())));
+    EXPECT_EQ(5, data[keys->intern("d")].as<int>());
+
+    // the size of an index only depends on the keys of the source
+    detail::KeyIndex<int> index;
+    int values[3] = {0, 1, 2};
+    index.set(Key(1000), &values[0]);
+    index.set(Key(10), &values[1]);
+    index.set(Key(500), &values[2]);
+    index.set(Key(10), &values[0]);
+    EXPECT_EQ(3, index.size());
+    EXPECT_EQ(&values[0], index.find(Key(10)));
+    EXPECT_EQ(&values[2], index.find(Key(500)));
+    EXPECT_EQ(nullptr, index.find(Key(11)));
+}
+
+TEST(TestKbData, TestRecycle) {
+    auto packHeader = [](const std::map<std::string, int>& metadata) {
+        msgpack::sbuffer sbuf;
+        msgpack::packer<msgpack::sbuffer> packer(sbuf);
+        packer.pack_map(3);
+        packer.pack(std::string("source"));
+        packer.pack(std::string("source"));
+        packer.pack(std::string("content"));
+        packer.pack(std::string("msgpack"));
+        packer.pack(std::string("metadata"));
+        packer.pack(metadata);
+        return zmq::message_t(sbuf.data(), sbuf.size());
+    };
+    auto packData = [](const std::map<std::string, int>& data) {
+        msgpack::sbuffer sbuf;
+        msgpack::pack(sbuf, data);
+        return zmq::message_t(sbuf.data(), sbuf.size());
+    };
+
+    auto layout = std::make_shared<detail::LayoutSlot>();
+    uint16_t a[4] = {1, 2, 3, 4};
+    std::vector<std::size_t> shape {4};
+
+    kb_data data;
+    data.setMetadata(data.appendHeader(packHeader({{"timestamp.tid", 1}})));
+    data.setArray("image.data", a, shape, "uint16_t");
+    data.setArray("image.mask", a, shape, "uint16_t");
+    data.appendLazyData(packData({{"a", 1}, {"b", 2}}), layout);
+    data.finishRefill();
+    EXPECT_EQ(1, data["a"].as<int>());
+    auto metadata_ptr = &data.metadata.at("timestamp.tid");
+    auto array_ptr = &data.array.at("image.data");
+    auto data_ptr = &data["b"];
+
+    // refill with the next train: the nodes of the existing keys are reused
+    data.recycle();
+    EXPECT_TRUE(data.isRecycled());
+    data.setMetadata(data.appendHeader(packHeader({{"timestamp.tid", 2}})));
+    data.setArray("image.data", a + 1, shape, "uint16_t");
+    data.appendLazyData(packData({{"b", 3}, {"c", 4}}), layout);
+    data.finishRefill();
+    EXPECT_FALSE(data.isRecycled());
+
+    EXPECT_EQ(metadata_ptr, &data.metadata.at("timestamp.tid"));
+    EXPECT_EQ(2, data.metadata["timestamp.tid"].as<int>());
+    ASSERT_EQ(1, data.array.size());
+    EXPECT_EQ(array_ptr, &data.array.at("image.data"));
+    EXPECT_EQ(2, data.array["image.data"].data<uint16_t>()[0]);
+    EXPECT_EQ(2, std::distance(data.begin(), data.end()));
+    EXPECT_EQ(data_ptr, &data["b"]);
+    EXPECT_EQ(3, data["b"].as<int>());
+    EXPECT_EQ(4, data["c"].as<int>());
+    EXPECT_THROW(data["a"], std::out_of_range);
+
+    // a source without "msgpack" data
+    data.recycle();
+    data.setArray("image.data", a, shape, "uint16_t");
+    data.finishRefill();
+    EXPECT_TRUE(data.metadata.empty());
+    EXPECT_EQ(0, std::distance(data.begin(), data.end()));
+    EXPECT_EQ(1, data.array.size());
+}
+
+TEST(TestKbData, TestNumpyArray) {
+    // an array encoded by msgpack-numpy, return the offset of its bytes
+    auto packArray = [](msgpack::sbuffer& sbuf,
+                        const std::string& type,
+                        const std::vector<float>& values) {
+        msgpack::packer<msgpack::sbuffer> packer(sbuf);
+        packer.pack_map(5);
+        packer.pack(std::string("nd"));
+        packer.pack(true);
+        packer.pack(std::string("type"));
+        packer.pack(type);
+        packer.pack(std::string("kind"));
+        packer.pack(std::string(""));
+        packer.pack(std::string("shape"));
+        packer.pack(std::vector<int>{2, 3});
+        packer.pack(std::string("data"));
+        packer.pack_bin(values.size() * sizeof(float));
+        auto offset = sbuf.size();
+        packer.pack_bin_body(reinterpret_cast<const char*>(values.data()),
+                             values.size() * sizeof(float));
+        return offset;
+    };
+
+    std::vector<float> values {0, 1, 2, 3, 4, 5};
+    msgpack::sbuffer sbuf;
+    msgpack::packer<msgpack::sbuffer> packer(sbuf);
+    packer.pack_map(4);
+    packer.pack(std::string("a"));
+    packer.pack(1);
+    // the bytes of "image" and "b" have different alignments
+    std::map<std::string, std::size_t> offsets;
+    packer.pack(std::string("image"));
+    offsets["image"] = packArray(sbuf, "<f4", values);
+    packer.pack(std::string("b"));
+    offsets["b"] = packArray(sbuf, "<f4", values);
+    packer.pack(std::string("swapped"));
+    packArray(sbuf, ">f4", values);
+    ASSERT_NE(offsets["image"] % sizeof(float), offsets["b"] % sizeof(float));
+
+    auto layout = std::make_shared<detail::LayoutSlot>();
+    for (int i = 0; i < 2; ++i) {
+        zmq::message_t msg(sbuf.data(), sbuf.size());
+        auto begin = static_cast<const char*>(msg.data());
+        auto end = begin + msg.size();
+
+        kb_data data;
+        data.appendLazyData(std::move(msg), layout);
+
+        // accessing the arrays decodes the data
+        ASSERT_EQ(2, data.array.size());
+        EXPECT_FALSE(data.isLazy());
+        for (auto& v : offsets) {
+            auto& image = data.array.at(v.first);
+            EXPECT_EQ(std::vector<std::size_t>({2, 3}), image.shape());
+            EXPECT_EQ("float", image.dtype());
+            EXPECT_EQ(5, image.data<float>()[5]);
+
+            // the array refers to the frame unless its bytes are misaligned
+            auto ptr = static_cast<const char*>(image.data());
+            EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(ptr) % alignof(float));
+            if (reinterpret_cast<std::uintptr_t>(begin + v.second) % alignof(float) == 0)
+                EXPECT_EQ(begin + v.second, ptr);
+            else
+                EXPECT_TRUE(ptr < begin || ptr >= end);
+        }
+
+        // the byte order of "swapped" is not supported
+        EXPECT_EQ(2, std::distance(data.begin(), data.end()));
+        EXPECT_EQ(1, data["a"].as<int>());
+        EXPECT_NO_THROW(data["swapped"]);
+        EXPECT_THROW(data["image"], std::out_of_range);
+    }
+    EXPECT_EQ(1, layout->hits());
+
+    // the size in bytes of these shapes only matches the data after an overflow
+    std::vector<std::vector<uint64_t>> overflowing_shapes {{(1ull << 63) + 3, 2}, {(1ull << 62) + 6}};
+    for (auto& shape : overflowing_shapes) {
+        msgpack::sbuffer sbuf_overflow;
+        msgpack::packer<msgpack::sbuffer> packer_overflow(sbuf_overflow);
+        packer_overflow.pack_map(4);
+        packer_overflow.pack(std::string("nd"));
+        packer_overflow.pack(true);
+        packer_overflow.pack(std::string("type"));
+        packer_overflow.pack(std::string("<f4"));
+        packer_overflow.pack(std::string("shape"));
+        packer_overflow.pack(shape);
+        packer_overflow.pack(std::string("data"));
+        packer_overflow.pack_bin(values.size() * sizeof(float));
+        packer_overflow.pack_bin_body(reinterpret_cast<const char*>(values.data()),
+                                      values.size() * sizeof(float));
+
+        auto handle = msgpack::unpack(sbuf_overflow.data(), sbuf_overflow.size());
+        void* ptr = nullptr;
+        std::vector<std::size_t> array_shape;
+        EXPECT_EQ(nullptr, detail::numpyArray(handle.get(), ptr, array_shape));
+    }
+}
+
+TEST(TestKbData, TestSharedOwnership) {
+    auto packData = [](const std::string& value) {
+        msgpack::sbuffer sbuf;
+        msgpack::pack(sbuf, std::map<std::string, std::string>({{"name", value}}));
+        return zmq::message_t(sbuf.data(), sbuf.size());
+    };
+    std::vector<float> values(100, 1.f);
+    std::vector<std::size_t> shape {100};
+
+    auto layout = std::make_shared<detail::LayoutSlot>();
+    kb_data data;
+    auto& msg = data.appendMsg(zmq::message_t(values.data(), values.size() * sizeof(float)));
+    auto ptr = const_cast<void*>(msg.data());
+    data.setArray("image.data", ptr, shape, DType::FLOAT, data.lastFrame());
+    data.appendLazyData(packData(std::string(100, 'a')), layout);
+    data.finishRefill();
+
+    // copies handed over to a consumer
+    NDArray array = data.array["image.data"];
+    MsgpackObject name = data["name"];
+    EXPECT_TRUE(array.owner() != nullptr);
+    EXPECT_EQ(ptr, array.data());
+
+    // the frames of the copies are not reused for the next train
+    data.recycle();
+    std::vector<float> other(100, 2.f);
+    auto& other_msg = data.appendMsg(zmq::message_t(other.data(), other.size() * sizeof(float)));
+    data.setArray("image.data", const_cast<void*>(other_msg.data()), shape, DType::FLOAT,
+                  data.lastFrame());
+    data.appendLazyData(packData(std::string(100, 'b')), layout);
+    data.finishRefill();
+    EXPECT_NE(ptr, data.array["image.data"].data());
+    EXPECT_EQ(2.f, data.array["image.data"].data<float>()[0]);
+
+    // the copies outlive the kb_data
+    data = kb_data();
+    EXPECT_EQ(1.f, array.data<float>()[99]);
+    EXPECT_EQ(std::string(100, 'a'), name.view().str());
+    EXPECT_EQ(1, array.owner().use_count());
+
+    // data which are not owned
+    NDArray external(values.data(), shape, DType::FLOAT);
+    EXPECT_TRUE(external.owner() == nullptr);
+}
+
 TEST(TestKbData, TestGeneral) {
     auto oh1 = _packObject_t<int>(100);
     auto oh2 = _packObject_t<float>(0.002);
@@ -86,6 +550,168 @@ TEST(TestNdarray, TestGeneral) {
     EXPECT_THROW((array_uint16.as<std::array<uint16_t, 13>>()), CastErrorNDArray);
 }
 
+TEST(TestNdarray, TestDType) {
+    uint16_t a[4] = {1, 2, 3, 4};
+    std::vector<std::size_t> shape {4};
+
+    NDArray array(a, shape, DType::UINT16);
+    EXPECT_EQ(DType::UINT16, array.dtypeId());
+    EXPECT_EQ("uint16_t", array.dtype());
+    EXPECT_EQ(a, array.data<uint16_t>());
+    EXPECT_EQ(10, array.visit(SumVisitor()));
+
+    array.assign(a, shape, "float");
+    EXPECT_EQ(DType::FLOAT, array.dtypeId());
+    EXPECT_THROW(array.data<uint16_t>(), TypeMismatchErrorNDArray);
+
+    // a type which is not supported keeps its name
+    array.assign(a, shape, "complex64");
+    EXPECT_EQ(DType::UNKNOWN, array.dtypeId());
+    EXPECT_EQ("complex64", array.dtype());
+    EXPECT_THROW(array.data<uint16_t>(), TypeMismatchErrorNDArray);
+    EXPECT_THROW(array.visit(SumVisitor()), TypeMismatchErrorNDArray);
+
+    array.assign(a, shape, DType::UNKNOWN);
+    EXPECT_EQ("unknown", array.dtype());
+    EXPECT_EQ(dtypeName(DType::UNKNOWN), NDArray().dtype());
+
+    EXPECT_EQ(DType::INT32, toDType("int32_t"));
+    EXPECT_EQ(DType::UNKNOWN, toDType("int32"));
+    EXPECT_EQ(8, itemSize(DType::DOUBLE));
+}
+
+TEST(TestNdarray, TestView) {
+    int a[24];
+    for (int i = 0; i < 24; ++i) a[i] = i;
+    NDArray array(a, std::vector<std::size_t>{2, 3, 4}, DType::INT32);
+    EXPECT_THROW((array.view<float, 3>()), TypeMismatchErrorNDArray);
+    EXPECT_THROW((array.view<int, 2>()), CastErrorNDArray);
+
+    auto view = array.view<int, 3>();
+    EXPECT_EQ(23, view(1, 2, 3));
+    EXPECT_TRUE(view.isContiguous());
+
+    // sub-views
+    EXPECT_EQ(12, view[1](0, 0));
+    auto column = view.select(2, 1);
+    EXPECT_EQ(21, column(1, 2));
+    EXPECT_FALSE(column.isContiguous());
+    EXPECT_THROW(view.select(1, 3), std::out_of_range);
+
+    // transposed views
+    EXPECT_EQ(23, view.transpose()(3, 2, 1));
+    EXPECT_EQ(20, view.transpose({{1, 0, 2}})(2, 1, 0));
+    EXPECT_THROW(view.transpose({{0, 0, 2}}), std::invalid_argument);
+
+    // pulse slicer
+    auto sliced = view.slice(2, "::2");
+    EXPECT_EQ(2, sliced.shape(2));
+    std::vector<int> copied(sliced.size());
+    sliced.copyTo(copied.data());
+    EXPECT_THAT(copied, ElementsAre(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22));
+    EXPECT_EQ(12, view.slice(0, "-1")(0, 0, 0));
+    EXPECT_EQ(3, view.slice(2, "::-1")(0, 0, 0));
+    EXPECT_EQ(0, view.slice(1, "5:").size());
+
+    int sum = 0;
+    view.forEach([&sum](int v) { sum += v; });
+    EXPECT_EQ(276, sum);
+}
+
+TEST(TestNdarray, TestConvert) {
+    // vector kernels and the remaining elements
+    std::vector<uint16_t> raw(37);
+    for (std::size_t i = 0; i < raw.size(); ++i) raw[i] = static_cast<uint16_t>(65535 - i);
+    NDArray array(raw.data(), std::vector<std::size_t>{raw.size()}, DType::UINT16);
+    EXPECT_THROW(array.as<std::vector<float>>(), TypeMismatchErrorNDArray);
+
+    auto converted = array.as<std::vector<float>>(karabo_bridge::convert);
+    ASSERT_EQ(raw.size(), converted.size());
+    for (std::size_t i = 0; i < raw.size(); ++i) EXPECT_EQ(65535.f - i, converted[i]);
+
+    auto as_double = array.as<std::vector<double>>(karabo_bridge::convert);
+    EXPECT_EQ(65499., as_double.back());
+    EXPECT_THROW((array.as<std::array<float, 4>>(karabo_bridge::convert)), CastErrorNDArray);
+
+    std::vector<int8_t> signed_raw {-128, -1, 0, 1, 127, -3, 5, -7, 9};
+    NDArray signed_array(signed_raw.data(), std::vector<std::size_t>{3, 3}, DType::INT8);
+    EXPECT_THAT(signed_array.as<std::vector<float>>(karabo_bridge::convert),
+                ElementsAre(-128, -1, 0, 1, 127, -3, 5, -7, 9));
+    std::array<int32_t, 9> as_int;
+    signed_array.convertTo(as_int.data(), as_int.size());
+    EXPECT_EQ(-128, as_int[0]);
+    EXPECT_THROW(signed_array.convertTo(as_int.data(), 8), CastErrorNDArray);
+
+    NDArray unknown(raw.data(), std::vector<std::size_t>{raw.size()}, "float16");
+    EXPECT_THROW(unknown.as<std::vector<float>>(karabo_bridge::convert), TypeMismatchErrorNDArray);
+
+    // large arrays are converted in parallel
+    std::vector<uint16_t> large(1 << 22);
+    for (std::size_t i = 0; i < large.size(); ++i) large[i] = static_cast<uint16_t>(i);
+    NDArray large_array(large.data(), std::vector<std::size_t>{large.size()}, DType::UINT16);
+    auto large_converted = large_array.as<std::vector<float>>(karabo_bridge::convert);
+    bool equal = true;
+    for (std::size_t i = 0; i < large.size(); ++i)
+        equal = equal && large_converted[i] == static_cast<float>(large[i]);
+    EXPECT_TRUE(equal);
+}
+
+TEST(TestNdarray, TestLargeCopy) {
+    // copied in parallel with non-temporal stores, starting from an
+    // unaligned address as in a received frame
+    std::vector<char> buffer((1 << 25) + 2 * sizeof(float) + 1);
+    auto ptr = buffer.data() + 1;
+    std::size_t size = (1 << 25) / sizeof(float) + 2;
+    for (std::size_t i = 0; i < size; ++i) {
+        float v = static_cast<float>(i);
+        std::memcpy(ptr + i * sizeof(float), &v, sizeof(float));
+    }
+    NDArray array(ptr, std::vector<std::size_t>{size}, DType::FLOAT);
+
+    auto copied = array.as<std::vector<float>>();
+    ASSERT_EQ(size, copied.size());
+    EXPECT_EQ(0, std::memcmp(ptr, copied.data(), size * sizeof(float)));
+
+    std::vector<float> out(size + 1, -1.f);
+    array.convertTo(out.data() + 1, size);
+    EXPECT_EQ(-1.f, out[0]);
+    EXPECT_EQ(0, std::memcmp(ptr, out.data() + 1, size * sizeof(float)));
+
+    // the pages touched by the pool do not overwrite the existing elements
+    std::vector<float> grown {1.f, 2.f};
+    detail::resizeForConvert(grown, size);
+    ASSERT_EQ(size, grown.size());
+    EXPECT_EQ(2.f, grown[1]);
+    EXPECT_EQ(0.f, grown.back());
+}
+
+TEST(TestSlice, TestParse) {
+    // first index and number of indices
+    using Range = std::pair<std::size_t, std::size_t>;
+    auto resolve = [](const std::string& s, std::size_t size) {
+        std::size_t first, count;
+        Slice::parse(s).resolve(size, first, count);
+        return Range(first, count);
+    };
+    EXPECT_EQ(Range(0, 32), resolve("::2", 64));
+    EXPECT_EQ(Range(0, 10), resolve("0:64", 10));
+    EXPECT_EQ(Range(1, 8), resolve("1:-1", 10));
+    EXPECT_EQ(Range(9, 10), resolve("::-1", 10));
+    EXPECT_EQ(Range(3, 1), resolve("3", 10));
+    EXPECT_EQ(Range(9, 1), resolve("-1", 10));
+    EXPECT_EQ(Range(0, 10), resolve("", 10));
+    EXPECT_EQ(0, resolve("20:", 10).second);
+
+    EXPECT_THROW(Slice::parse("a:b"), std::invalid_argument);
+    EXPECT_THROW(Slice::parse("::0"), std::invalid_argument);
+    EXPECT_THROW(Slice::parse("1:2:3:4"), std::invalid_argument);
+
+    // a single index is not clipped
+    EXPECT_THROW(resolve("10", 10), std::out_of_range);
+    EXPECT_THROW(resolve("-11", 10), std::out_of_range);
+    EXPECT_THROW(resolve("0", 0), std::out_of_range);
+}
+
 TEST(TestMsgpackObject, TestGeneral) {
     auto oh_uint = _packObject_t<std::size_t>(2147483648);
     auto obj_uint = oh_uint.get().as<MsgpackObject>();
@@ -156,4 +782,92 @@ TEST(TestMsgpackObject, TestGeneral) {
     EXPECT_NO_THROW(obj_bin.as<std::vector<unsigned char>>());
 }
 
+TEST(TestMsgpackObject, TestVisit) {
+    auto oh_uint = _packObject_t<int>(1);
+    auto obj_uint = oh_uint.get().as<MsgpackObject>();
+    EXPECT_EQ(DType::UINT64, obj_uint.dtypeId());
+    EXPECT_EQ("uint64_t", obj_uint.visit(TypeVisitor()));
+
+    auto oh_float = _packObject_t(std::vector<float>({1, 2}));
+    auto obj_float = oh_float.get().as<MsgpackObject>();
+    EXPECT_EQ(DType::FLOAT, obj_float.dtypeId());
+    EXPECT_EQ("vector of float", obj_float.visit(TypeVisitor()));
+
+    auto oh_str = _packObject_t(std::string("abc"));
+    EXPECT_EQ("view", oh_str.get().as<MsgpackObject>().visit(TypeVisitor()));
+
+    auto oh_map = _packObject_t<std::map<int, int>>({{1, 2}});
+    auto obj_map = oh_map.get().as<MsgpackObject>();
+    EXPECT_EQ(DType::UNDEFINED, obj_map.dtypeId());
+    EXPECT_THROW(obj_map.visit(TypeVisitor()), CastErrorMsgpackObject);
+}
+
+TEST(TestMsgpackObject, TestBulkDecode) {
+    std::vector<float> vec_f(1000);
+    for (std::size_t i = 0; i < vec_f.size(); ++i) vec_f[i] = 0.5f * i;
+    auto oh_f = _packObject_t(vec_f);
+    auto obj_f = oh_f.get().as<MsgpackObject>();
+    EXPECT_EQ(vec_f, obj_f.as<std::vector<float>>());
+    EXPECT_THAT(obj_f.as<std::vector<double>>(), ElementsAreArray(vec_f));
+    // no float to integer conversion
+    EXPECT_THROW(obj_f.as<std::vector<int>>(), CastErrorMsgpackObject);
+
+    std::vector<int64_t> vec_i {-3, 0, 2, 127};
+    auto oh_i = _packObject_t(vec_i);
+    auto obj_i = oh_i.get().as<MsgpackObject>();
+    EXPECT_THAT(obj_i.as<std::vector<int8_t>>(), ElementsAreArray(vec_i));
+    EXPECT_THAT(obj_i.as<std::vector<double>>(), ElementsAreArray(vec_i));
+    EXPECT_THROW(obj_i.as<std::vector<uint32_t>>(), CastErrorMsgpackObject);
+
+    std::vector<uint64_t> vec_u {1, std::numeric_limits<uint64_t>::max()};
+    auto oh_u = _packObject_t(vec_u);
+    auto obj_u = oh_u.get().as<MsgpackObject>();
+    EXPECT_EQ(vec_u, obj_u.as<std::vector<uint64_t>>());
+    EXPECT_THROW(obj_u.as<std::vector<int64_t>>(), CastErrorMsgpackObject);
+
+    // mixed types fall back to the element-wise conversion
+    auto oh_mixed = _packObject_t(std::make_tuple(1, -2.5, 3));
+    auto obj_mixed = oh_mixed.get().as<MsgpackObject>();
+    EXPECT_THAT(obj_mixed.as<std::vector<double>>(), ElementsAre(1, -2.5, 3));
+    EXPECT_THROW(obj_mixed.as<std::vector<int>>(), CastErrorMsgpackObject);
+
+    auto oh_empty = _packObject_t(std::vector<float>());
+    EXPECT_TRUE(oh_empty.get().as<MsgpackObject>().as<std::vector<float>>().empty());
+}
+
+TEST(TestMsgpackObject, TestView) {
+    std::string str(100, 'a');
+    auto oh_str = _packObject_t(str);
+    auto obj_str = oh_str.get().as<MsgpackObject>();
+    auto view_str = obj_str.view();
+    EXPECT_EQ(str, view_str.str());
+    EXPECT_TRUE(view_str == str.c_str());
+    EXPECT_EQ(str, obj_str.as<StringView>().str());
+
+    auto oh_bin = _packBin_t(std::vector<int>({1, 2, 3, 4}));
+    auto obj_bin = oh_bin.get().as<MsgpackObject>();
+    auto view_bin = obj_bin.view();
+    EXPECT_EQ(16, view_bin.size());
+    EXPECT_EQ(2, reinterpret_cast<const int*>(view_bin.data())[1]);
+
+    auto oh_vec = _packObject_t(std::vector<std::string>({"a", "bc"}));
+    auto views = oh_vec.get().as<MsgpackObject>().as<std::vector<StringView>>();
+    ASSERT_EQ(2, views.size());
+    EXPECT_EQ("bc", views[1].str());
+
+    auto oh_int = _packObject_t<int>(1);
+    EXPECT_THROW(oh_int.get().as<MsgpackObject>().view(), CastErrorMsgpackObject);
+    EXPECT_THROW(oh_int.get().as<MsgpackObject>().as<StringView>(), CastErrorMsgpackObject);
+
+    // the strings of a referencing unpack point into the frame
+    msgpack::sbuffer sbuf;
+    msgpack::pack(sbuf, str);
+    zmq::message_t msg(sbuf.data(), sbuf.size());
+    msgpack::zone zone;
+    auto view_frame = detail::unpackFrame(zone, msg).as<StringView>();
+    EXPECT_EQ(str, view_frame.str());
+    EXPECT_GE(view_frame.data(), static_cast<const char*>(msg.data()));
+    EXPECT_LT(view_frame.data(), static_cast<const char*>(msg.data()) + msg.size());
+}
+
 } // karabo_bridge
\ No newline at end of file
@@ -0,0 +1,98 @@
+//
+// Helper functions shared by the unittests.
+//
+#ifndef KARABO_BRIDGE_TEST_UTILS_HPP
+#define KARABO_BRIDGE_TEST_UTILS_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "karabo-bridge/kb_client.hpp"
+
+
+namespace karabo_bridge {
+
+/*
+ * Pack a train of one source as sent by a bridge server:
+ *
+ * - the header of the "msgpack" data with the train ID in "metadata";
+ * - the "msgpack" data "header.trainId" (the train ID) and "detector.name"
+ *   (100 characters);
+ * - if "array_path" is not empty, the header and the data of a float
+ *   array of "shape" filled with the train ID.
+ */
+inline std::vector<zmq::message_t> packTrain(const std::string& source,
+                                             uint64_t tid,
+                                             const std::string& array_path="",
+                                             const std::vector<unsigned int>& shape={}) {
+    std::vector<zmq::message_t> parts;
+
+    msgpack::sbuffer header;
+    msgpack::packer<msgpack::sbuffer> packer(header);
+    packer.pack_map(3);
+    packer.pack(std::string("source"));
+    packer.pack(source);
+    packer.pack(std::string("content"));
+    packer.pack(std::string("msgpack"));
+    packer.pack(std::string("metadata"));
+    packer.pack(std::map<std::string, uint64_t>{{"timestamp.tid", tid}});
+    parts.emplace_back(header.data(), header.size());
+
+    msgpack::sbuffer data;
+    msgpack::packer<msgpack::sbuffer> data_packer(data);
+    data_packer.pack_map(2);
+    data_packer.pack(std::string("header.trainId"));
+    data_packer.pack(tid);
+    data_packer.pack(std::string("detector.name"));
+    data_packer.pack(std::string(100, 'a'));
+    parts.emplace_back(data.data(), data.size());
+
+    if (array_path.empty()) return parts;
+
+    msgpack::sbuffer array_header;
+    msgpack::packer<msgpack::sbuffer> array_packer(array_header);
+    array_packer.pack_map(5);
+    array_packer.pack(std::string("source"));
+    array_packer.pack(source);
+    array_packer.pack(std::string("content"));
+    array_packer.pack(std::string("array"));
+    array_packer.pack(std::string("path"));
+    array_packer.pack(array_path);
+    array_packer.pack(std::string("dtype"));
+    array_packer.pack(std::string("float32"));
+    array_packer.pack(std::string("shape"));
+    array_packer.pack(shape);
+    parts.emplace_back(array_header.data(), array_header.size());
+
+    std::size_t size = 1;
+    for (auto dim : shape) size *= dim;
+    std::vector<float> image(size, static_cast<float>(tid));
+    parts.emplace_back(image.data(), image.size() * sizeof(float));
+    return parts;
+}
+
+// Send the parts of a multipart message, e.g. after the envelope of a ROUTER reply.
+inline void sendMultipart(zmq::socket_t& socket, std::vector<zmq::message_t>& parts) {
+    for (std::size_t i = 0; i < parts.size(); ++i)
+        socket.send(parts[i], i + 1 < parts.size() ? ZMQ_SNDMORE : 0);
+}
+
+// Send a train of one source, see packTrain().
+inline void sendTrain(zmq::socket_t& socket,
+                      const std::string& source,
+                      uint64_t tid,
+                      const std::string& array_path="",
+                      const std::vector<unsigned int>& shape={}) {
+    auto parts = packTrain(source, tid, array_path, shape);
+    sendMultipart(socket, parts);
+}
+
+// Return the train ID in the metadata of a source.
+inline uint64_t trainId(std::map<std::string, kb_data>& data, const std::string& source) {
+    return data.at(source).metadata.at("timestamp.tid").as<uint64_t>();
+}
+
+} // karabo_bridge
+
+#endif // KARABO_BRIDGE_TEST_UTILS_HPP